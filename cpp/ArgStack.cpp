@@ -0,0 +1,3 @@
+#include "ArgStack.h"
+
+malValueVec malArgs::s_stack;
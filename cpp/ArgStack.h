@@ -0,0 +1,62 @@
+#ifndef INCLUDE_ARGSTACK_H
+#define INCLUDE_ARGSTACK_H
+
+#include "Types.h"
+
+#include <memory>
+
+// The argument vector for one function application. Argument vectors are
+// carved from a single stack shared by the whole interpreter, and released
+// in LIFO order as the malArgs which own them go out of scope, so building
+// one doesn't touch the heap.
+//
+// The stack is only ever grown within the capacity reserved up front, so
+// iterators into it stay valid. A malArgs which won't fit gets a vector of
+// its own instead.
+//
+// Anything which keeps arguments beyond the call, such as the & rest
+// parameter of a lambda, must copy them out.
+class malArgs {
+public:
+    enum { STACK_SIZE = 64 * 1024 };
+
+    explicit malArgs(int count) {
+        malValueVec& stack = s_stack;
+        if (stack.capacity() == 0) {
+            stack.reserve(STACK_SIZE);
+        }
+        if (stack.size() + count <= stack.capacity()) {
+            size_t base = stack.size();
+            stack.resize(base + count);
+            m_begin = stack.begin() + base;
+        }
+        else {
+            m_overflow.reset(new malValueVec(count));
+            m_begin = m_overflow->begin();
+        }
+        m_end = m_begin + count;
+    }
+
+    ~malArgs() {
+        if (!m_overflow) {
+            s_stack.resize(m_begin - s_stack.begin());
+        }
+    }
+
+    malValueIter begin() const { return m_begin; }
+    malValueIter end()   const { return m_end; }
+
+    malValuePtr& operator [] (int index) const { return m_begin[index]; }
+
+private:
+    malArgs(const malArgs&); // no copy ctor
+    malArgs& operator = (const malArgs&); // no assignments
+
+    malValueIter m_begin;
+    malValueIter m_end;
+    std::unique_ptr<malValueVec> m_overflow;
+
+    static malValueVec s_stack;
+};
+
+#endif // INCLUDE_ARGSTACK_H
@@ -0,0 +1,169 @@
+#include "Collector.h"
+#include "Environment.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+malTracked* malCollector::s_tracked = NULL;
+size_t malCollector::s_population = 0;
+size_t malCollector::s_promoted = 0;
+size_t malCollector::s_allocations = 0;
+size_t malCollector::s_threshold = MIN_THRESHOLD;
+malCollector::Stats malCollector::s_stats;
+
+// Calls visit for each tracked object this one holds a reference to.
+template<class Visit>
+void malCollector::visitChildren(malTracked* object, Visit visit)
+{
+    if (object->m_kind == malTracked::TRACKED_ENV) {
+        malEnv* env = static_cast<malEnv*>(object);
+        if (env->m_outer) {
+            visit(env->m_outer.ptr());
+        }
+        env->forEachValue([&visit](const malValuePtr& value) {
+            if (malLambda* lambda = DYNAMIC_CAST(malLambda, value)) {
+                visit(lambda);
+            }
+        });
+    }
+    else {
+        malLambda* lambda = static_cast<malLambda*>(object);
+        if (lambda->m_env) {
+            visit(lambda->m_env.ptr());
+        }
+    }
+}
+
+size_t malCollector::collect()
+{
+    size_t reclaimed = collectGeneration(false);
+    s_stats.majorCollections++;
+    s_promoted = 0;
+    s_threshold = std::max<size_t>(MIN_THRESHOLD, s_population);
+    return reclaimed;
+}
+
+void malCollector::collectNursery()
+{
+    collectGeneration(true);
+    s_stats.minorCollections++;
+    if (s_promoted >= s_threshold) {
+        collect();
+    }
+}
+
+// Collects either everything, or just the nursery: the objects which
+// haven't survived a collection yet, which are at the front of the list.
+size_t malCollector::collectGeneration(bool nursery)
+{
+    using namespace std::chrono;
+    steady_clock::time_point start = steady_clock::now();
+    size_t before = s_population;
+
+    // The end of the objects to look at.
+    auto inGeneration = [nursery](malTracked* object) {
+        return (object != NULL) && !(nursery && object->m_old);
+    };
+
+    // Subtract the references the objects hold to each other from their
+    // counts, leaving the references from outside.
+    for (malTracked* object = s_tracked; inGeneration(object);
+         object = object->m_next) {
+        object->m_gcCount = (object->m_kind == malTracked::TRACKED_ENV)
+            ? static_cast<malEnv*>(object)->refCount()
+            : static_cast<malLambda*>(object)->refCount();
+    }
+    for (malTracked* object = s_tracked; inGeneration(object);
+         object = object->m_next) {
+        visitChildren(object, [&inGeneration](malTracked* child) {
+            if (inGeneration(child)) {
+                child->m_gcCount--;
+            }
+        });
+    }
+
+    // Anything referenced from outside is live, as is everything it
+    // reaches.
+    std::vector<malTracked*> pending;
+    for (malTracked* object = s_tracked; inGeneration(object);
+         object = object->m_next) {
+        if (object->m_gcCount > 0) {
+            pending.push_back(object);
+        }
+    }
+    while (!pending.empty()) {
+        malTracked* object = pending.back();
+        pending.pop_back();
+        visitChildren(object, [&inGeneration, &pending](malTracked* child) {
+            if (inGeneration(child) && (child->m_gcCount <= 0)) {
+                child->m_gcCount = 1;
+                pending.push_back(child);
+            }
+        });
+    }
+
+    // The rest is garbage. Hold on to it while the cycles are broken, so
+    // that nothing is deleted out from under us, then let it all go. The
+    // survivors move to the old generation.
+    std::vector<malEnvPtr> envs;
+    malValueVec lambdas;
+    size_t promoted = 0;
+    for (malTracked* object = s_tracked; inGeneration(object);
+         object = object->m_next) {
+        if (object->m_gcCount > 0) {
+            promoted += !object->m_old;
+            object->m_old = true;
+        }
+        else if (object->m_kind == malTracked::TRACKED_ENV) {
+            envs.push_back(static_cast<malEnv*>(object));
+        }
+        else {
+            lambdas.push_back(static_cast<malLambda*>(object));
+        }
+    }
+    for (auto& env : envs) {
+        env->clear();
+    }
+    for (auto& lambda : lambdas) {
+        STATIC_CAST(malLambda, lambda)->m_env = NULL;
+    }
+    envs.clear();
+    lambdas.clear();
+
+    size_t reclaimed = before - s_population;
+    uint64_t pauseNs =
+        duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    s_stats.allocated += s_allocations;
+    s_stats.promoted += promoted;
+    s_stats.reclaimed += reclaimed;
+    s_allocations = 0;
+    s_promoted += promoted;
+    s_stats.pauseNs += pauseNs;
+    s_stats.maxPauseNs = std::max(s_stats.maxPauseNs, pauseNs);
+    return reclaimed;
+}
+
+#if GC_GENERATIONAL
+
+// Reports the collections once the program has finished.
+static struct CollectorReport {
+    ~CollectorReport() {
+        const malCollector::Stats& stats = malCollector::stats();
+        size_t collections = stats.minorCollections + stats.majorCollections;
+        fprintf(stderr, "gc: %zu nursery and %zu full collections, "
+                        "%zu reclaimed, %.1f%% of allocations promoted\n",
+                stats.minorCollections, stats.majorCollections,
+                stats.reclaimed, stats.allocated
+                    ? 100.0 * stats.promoted / stats.allocated : 0.0);
+        fprintf(stderr, "gc: pauses %.3f ms in total, %.1f us on average, "
+                        "%.1f us at most\n",
+                stats.pauseNs / 1e6,
+                collections ? stats.pauseNs / 1e3 / collections : 0.0,
+                stats.maxPauseNs / 1e3);
+    }
+} collectorReport;
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef INCLUDE_COLLECTOR_H
+#define INCLUDE_COLLECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Reference counting never frees a cycle, and closures make them all the
+// time: (def! f (fn* ...)) leaves f's environment holding f, which holds
+// its environment. The collector finds these among environments and
+// lambdas by trial deletion. It takes each object's count, subtracts the
+// references the tracked objects hold to one another, and whatever has
+// none left from outside, and can't be reached from anything which has,
+// is garbage.
+//
+// References from anything else (a list, a hash, an atom) count as being
+// from outside, so a cycle running through one of those is kept. That
+// misses some garbage, but never frees anything live.
+//
+// Building with GC_GENERATIONAL (make GC=gen) collects by generation.
+// Objects allocated since the last collection make up the nursery, which
+// is collected on its own, treating references from older objects as being
+// from outside. Survivors are promoted to the old generation, which is only
+// collected in full once enough objects have been promoted. The pause
+// times and promotion rate are reported on stderr at exit.
+
+// Base class of environments and lambdas, linking each into the list of
+// objects the collector looks at for as long as it exists.
+class malTracked {
+public:
+    enum Kind { TRACKED_ENV, TRACKED_LAMBDA };
+
+protected:
+    malTracked(Kind kind);
+    ~malTracked();
+
+private:
+    malTracked(const malTracked&); // no copy ctor
+    malTracked& operator = (const malTracked&); // no assignments
+
+    friend class malCollector;
+
+    malTracked* m_prev;
+    malTracked* m_next;
+    int         m_gcCount;
+    const Kind  m_kind;
+    bool        m_old;      // survived a collection
+};
+
+class malCollector {
+public:
+    enum {
+        MIN_THRESHOLD   = 10000,
+        NURSERY_SIZE    = 2048,
+    };
+
+    struct Stats {
+        size_t minorCollections;
+        size_t majorCollections;
+        size_t reclaimed;
+        size_t allocated;
+        size_t promoted;    // survived into the old generation
+        uint64_t pauseNs;
+        uint64_t maxPauseNs;
+    };
+
+    // Collects once enough environments and lambdas have been allocated
+    // since the last collection. Only call this where every live object is
+    // held by a counted reference, so not while constructing one.
+    static void safePoint() {
+#if GC_GENERATIONAL
+        if (s_allocations >= NURSERY_SIZE) {
+            collectNursery();
+        }
+#else
+        if (s_allocations >= s_threshold) {
+            collect();
+        }
+#endif
+    }
+
+    // Collects everything, and returns the number of environments and
+    // lambdas reclaimed.
+    static size_t collect();
+
+    static const Stats& stats() { return s_stats; }
+
+private:
+    friend class malTracked;
+
+    static void collectNursery();
+    static size_t collectGeneration(bool nursery);
+
+    template<class Visit>
+    static void visitChildren(malTracked* object, Visit visit);
+
+    static malTracked* s_tracked;   // newest first
+    static size_t s_population;
+    static size_t s_promoted;       // since the last full collection
+    static size_t s_allocations;
+    static size_t s_threshold;
+    static Stats s_stats;
+};
+
+inline malTracked::malTracked(Kind kind)
+: m_prev(NULL)
+, m_next(malCollector::s_tracked)
+, m_gcCount(0)
+, m_kind(kind)
+, m_old(false)
+{
+    if (m_next) {
+        m_next->m_prev = this;
+    }
+    malCollector::s_tracked = this;
+    malCollector::s_population++;
+    malCollector::s_allocations++;
+}
+
+inline malTracked::~malTracked()
+{
+    if (m_prev) {
+        m_prev->m_next = m_next;
+    }
+    else {
+        malCollector::s_tracked = m_next;
+    }
+    if (m_next) {
+        m_next->m_prev = m_prev;
+    }
+    malCollector::s_population--;
+}
+
+#endif // INCLUDE_COLLECTOR_H
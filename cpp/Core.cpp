@@ -1,4 +1,5 @@
 #include "MAL.h"
+#include "ArgStack.h"
 #include "Environment.h"
 #include "StaticList.h"
 #include "Types.h"
@@ -21,10 +22,11 @@
 
 static String printValues(malValueIter begin, malValueIter end,
                            const String& sep, bool readably);
+static malValuePtr counterHash(const memStats::Counter& counter);
 
 static StaticList<malBuiltIn*> handlers;
 
-#define ARG(type, name) type* name = VALUE_CAST(type, *argsBegin++)
+#define ARG(type, name) auto name = VALUE_CAST(type, *argsBegin++)
 
 #define FUNCNAME(uniq) builtIn ## uniq
 #define HRECNAME(uniq) handler ## uniq
@@ -102,9 +104,12 @@ BUILTIN("<=")
 BUILTIN("=")
 {
     CHECK_ARGS_IS(2);
-    const malValue* lhs = (*argsBegin++).ptr();
-    const malValue* rhs = (*argsBegin++).ptr();
+    malValuePtr lhs = *argsBegin++;
+    malValuePtr rhs = *argsBegin++;
 
+    if (lhs.isImmediate() && rhs.isImmediate()) {
+        return mal::boolean(lhs == rhs);
+    }
     return mal::boolean(lhs->isEqualTo(rhs));
 }
 
@@ -113,14 +118,14 @@ BUILTIN("apply")
     CHECK_ARGS_AT_LEAST(2);
     malValuePtr op = *argsBegin++; // this gets checked in APPLY
 
+    const malSequence* lastArg = VALUE_CAST(malSequence, *(argsEnd-1));
+    malArgs args((argsEnd - 1 - argsBegin) + lastArg->count());
+
     // Copy the first N-1 arguments in.
-    malValueVec args(argsBegin, argsEnd-1);
+    malValueIter out = std::copy(argsBegin, argsEnd-1, args.begin());
 
     // Then append the argument as a list.
-    const malSequence* lastArg = VALUE_CAST(malSequence, *(argsEnd-1));
-    for (int i = 0; i < lastArg->count(); i++) {
-        args.push_back(lastArg->item(i));
-    }
+    std::copy(lastArg->begin(), lastArg->end(), out);
 
     return APPLY(op, args.begin(), args.end());
 }
@@ -128,6 +133,9 @@ BUILTIN("apply")
 BUILTIN("assoc")
 {
     CHECK_ARGS_AT_LEAST(1);
+    if (const malVector* vector = DYNAMIC_CAST(malVector, *argsBegin)) {
+        return vector->assoc(argsBegin + 1, argsEnd);
+    }
     ARG(malHash, hash);
 
     return hash->assoc(argsBegin, argsEnd);
@@ -142,21 +150,27 @@ BUILTIN("atom")
 
 BUILTIN("concat")
 {
-    int count = 0;
-    for (auto it = argsBegin; it != argsEnd; ++it) {
-        const malSequence* seq = VALUE_CAST(malSequence, *it);
-        count += seq->count();
+    if (argsBegin == argsEnd) {
+        return mal::list();
     }
 
-    malValueVec* items = new malValueVec(count);
-    int offset = 0;
-    for (auto it = argsBegin; it != argsEnd; ++it) {
-        const malSequence* seq = STATIC_CAST(malSequence, *it);
-        std::copy(seq->begin(), seq->end(), items->begin() + offset);
-        offset += seq->count();
+    // The last sequence becomes the shared tail of the result, so only the
+    // ones before it are copied.
+    malValueVec items;
+    for (auto it = argsBegin; it != argsEnd - 1; ++it) {
+        const malSequence* seq = VALUE_CAST(malSequence, *it);
+        items.insert(items.end(), seq->begin(), seq->end());
     }
 
-    return mal::list(items);
+    malValuePtr list = *(argsEnd - 1);
+    if (!DYNAMIC_CAST(malList, list)) {
+        const malSequence* seq = VALUE_CAST(malSequence, list);
+        list = mal::list(new malValueVec(seq->begin(), seq->end()));
+    }
+    for (auto it = items.rbegin(), end = items.rend(); it != end; ++it) {
+        list = mal::cons(*it, list);
+    }
+    return list;
 }
 
 BUILTIN("conj")
@@ -171,13 +185,8 @@ BUILTIN("cons")
 {
     CHECK_ARGS_IS(2);
     malValuePtr first = *argsBegin++;
-    ARG(malSequence, rest);
 
-    malValueVec* items = new malValueVec(1 + rest->count());
-    items->at(0) = first;
-    std::copy(rest->begin(), rest->end(), items->begin() + 1);
-
-    return mal::list(items);
+    return mal::cons(first, *argsBegin);
 }
 
 BUILTIN("contains?")
@@ -197,6 +206,9 @@ BUILTIN("count")
         return mal::integer(0);
     }
 
+    if (const malString* str = DYNAMIC_CAST(malString, *argsBegin)) {
+        return mal::integer(str->length());
+    }
     ARG(malSequence, seq);
     return mal::integer(seq->count());
 }
@@ -241,6 +253,12 @@ BUILTIN("first")
     return seq->first();
 }
 
+BUILTIN("gc")
+{
+    CHECK_ARGS_IS(0);
+    return mal::integer(malCollector::collect());
+}
+
 BUILTIN("get")
 {
     CHECK_ARGS_IS(2);
@@ -267,7 +285,20 @@ BUILTIN("keyword")
 {
     CHECK_ARGS_IS(1);
     ARG(malString, token);
-    return mal::keyword(":" + token->value());
+    StringView chars = token->value();
+    return mal::keyword(String(":").append(chars.data(), chars.size()));
+}
+
+BUILTIN("mem-stats")
+{
+    CHECK_ARGS_IS(0);
+    malHash::Map map;
+    for (int kind = 0; kind < memStats::KINDS; kind++) {
+        map.insert(mal::keyword(STRF(":%s", memStats::names[kind])),
+                   counterHash(memStats::counters[kind]));
+    }
+    map.insert(mal::keyword(":total"), counterHash(memStats::total));
+    return mal::hash(map);
 }
 
 BUILTIN("meta")
@@ -320,7 +351,7 @@ BUILTIN("readline")
     CHECK_ARGS_IS(1);
     ARG(malString, str);
 
-    return readline(str->value());
+    return readline(str->value().str());
 }
 
 BUILTIN("reset!")
@@ -334,7 +365,7 @@ BUILTIN("rest")
 {
     CHECK_ARGS_IS(1);
     if (*argsBegin == mal::nilValue()) {
-        return mal::list(new malValueVec(0));
+        return mal::list();
     }
     ARG(malSequence, seq);
     return seq->rest();
@@ -348,19 +379,26 @@ BUILTIN("seq")
         return mal::nilValue();
     }
     if (const malSequence* seq = DYNAMIC_CAST(malSequence, arg)) {
-        return seq->isEmpty() ? mal::nilValue()
-                              : mal::list(seq->begin(), seq->end());
+        if (seq->isEmpty()) {
+            return mal::nilValue();
+        }
+        if (DYNAMIC_CAST(malList, arg)) {
+            return arg;
+        }
+        return mal::list(new malValueVec(seq->begin(), seq->end()));
     }
     if (const malString* strVal = DYNAMIC_CAST(malString, arg)) {
-        const String str = strVal->value();
-        int length = str.length();
+        int length = strVal->length();
         if (length == 0)
             return mal::nilValue();
 
-        malValueVec* items = new malValueVec(length);
-        for (int i = 0; i < length; i++) {
-            (*items)[i] = mal::string(str.substr(i, 1));
-        }
+        malValueVec* items = new malValueVec();
+        items->reserve(length);
+        strVal->forEachRun([items](StringView run) {
+            for (size_t i = 0; i < run.size(); i++) {
+                items->push_back(mal::string(run.substr(i, 1)));
+            }
+        });
         return mal::list(items);
     }
     MAL_FAIL("%s is not a string or sequence", arg->print(true).c_str());
@@ -374,8 +412,8 @@ BUILTIN("slurp")
 
     std::ios_base::openmode openmode =
         std::ios::ate | std::ios::in | std::ios::binary;
-    std::ifstream file(filename->value().c_str(), openmode);
-    MAL_CHECK(!file.fail(), "Cannot open %s", filename->value().c_str());
+    std::ifstream file(filename->c_str(), openmode);
+    MAL_CHECK(!file.fail(), "Cannot open %s", filename->c_str());
 
     String data;
     data.reserve(file.tellg());
@@ -386,9 +424,33 @@ BUILTIN("slurp")
     return mal::string(data);
 }
 
+// Long strings are joined as ropes rather than copied, so that building a
+// string up a piece at a time doesn't take quadratic time.
 BUILTIN("str")
 {
-    return mal::string(printValues(argsBegin, argsEnd, "", false));
+    malRopePtr rope;
+    String flat;
+    for (auto it = argsBegin; it != argsEnd; ++it) {
+        const malString* str = DYNAMIC_CAST(malString, *it);
+        if (str && (str->length() > malRope::MAX_MERGED_LEAF)) {
+            if (!flat.empty()) {
+                rope = malRope::join(rope,
+                            malRope::leaf(malStringBuffer::create(flat)));
+                flat.clear();
+            }
+            rope = malRope::join(rope, str->rope());
+        }
+        else {
+            printTo(flat, *it, false);
+        }
+    }
+    if (!rope) {
+        return mal::string(flat);
+    }
+    if (!flat.empty()) {
+        rope = malRope::join(rope, malRope::leaf(malStringBuffer::create(flat)));
+    }
+    return mal::string(rope);
 }
 
 BUILTIN("swap!")
@@ -398,7 +460,7 @@ BUILTIN("swap!")
 
     malValuePtr op = *argsBegin++; // this gets checked in APPLY
 
-    malValueVec args(1 + argsEnd - argsBegin);
+    malArgs args(1 + argsEnd - argsBegin);
     args[0] = atom->deref();
     std::copy(argsBegin, argsEnd, args.begin() + 1);
 
@@ -451,26 +513,36 @@ BUILTIN("with-meta")
     return obj->withMeta(meta);
 }
 
-void installCore(malEnvPtr env) {
+void installCore(const malEnvPtr& env) {
     for (auto it = handlers.begin(), end = handlers.end(); it != end; ++it) {
         malBuiltIn* handler = *it;
         env->set(handler->name(), handler);
     }
 }
 
+static malValuePtr counterHash(const memStats::Counter& counter)
+{
+    malHash::Map map;
+    map.insert(mal::keyword(":live"), mal::integer(counter.live));
+    map.insert(mal::keyword(":peak"), mal::integer(counter.peak));
+    map.insert(mal::keyword(":bytes"), mal::integer(counter.bytes));
+    map.insert(mal::keyword(":peak-bytes"), mal::integer(counter.peakBytes));
+    return mal::hash(map);
+}
+
 static String printValues(malValueIter begin, malValueIter end,
                           const String& sep, bool readably)
 {
     String out;
 
     if (begin != end) {
-        out += (*begin)->print(readably);
+        printTo(out, *begin, readably);
         ++begin;
     }
 
     for ( ; begin != end; ++begin) {
         out += sep;
-        out += (*begin)->print(readably);
+        printTo(out, *begin, readably);
     }
 
     return out;
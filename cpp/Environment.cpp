@@ -3,71 +3,214 @@
 
 #include <algorithm>
 
-malEnv::malEnv(malEnvPtr outer)
-: m_outer(outer)
+unsigned malEnv::s_version = 1;
+int malEnv::s_globalCount = 0;
+std::vector<bool> malEnv::s_isBoundLocally;
+std::vector<bool> malEnv::s_namesMacro;
+
+static bool isMacro(const malValuePtr& value)
+{
+    const malLambda* lambda = DYNAMIC_CAST(malLambda, value);
+    return lambda && lambda->isMacro();
+}
+
+malEnv::malEnv(const malEnvPtr& outer)
+: malTracked(TRACKED_ENV)
+, m_outer(outer)
+, m_isGlobal(!outer)
+, m_slotCount(0)
+, m_slotCapacity(0)
 {
     TRACE_ENV("Creating malEnv %p, outer=%p\n", this, m_outer.ptr());
+    if (m_isGlobal) {
+        s_globalCount++;
+        s_version++;
+    }
 }
 
-malEnv::malEnv(malEnvPtr outer, const StringVec& bindings,
-               malValueIter argsBegin, malValueIter argsEnd)
-: m_outer(outer)
+malEnv::malEnv(const malEnvPtr& outer, int slots)
+: malTracked(TRACKED_ENV)
+, m_outer(outer)
+, m_isGlobal(!outer)
+, m_slotCount(0)
+, m_slotCapacity(slots)
 {
     TRACE_ENV("Creating malEnv %p, outer=%p\n", this, m_outer.ptr());
-    int n = bindings.size();
-    auto it = argsBegin;
-    for (int i = 0; i < n; i++) {
-        if (bindings[i] == "&") {
-            MAL_CHECK(i == n - 2, "There must be one parameter after the &");
-
-            set(bindings[n-1], mal::list(it, argsEnd));
-            return;
-        }
-        MAL_CHECK(it != argsEnd, "Not enough parameters");
-        set(bindings[i], *it);
-        ++it;
+    if (m_isGlobal) {
+        s_globalCount++;
+        s_version++;
     }
-    MAL_CHECK(it == argsEnd, "Too many parameters");
 }
 
 malEnv::~malEnv()
 {
     TRACE_ENV("Destroying malEnv %p, outer=%p\n", this, m_outer.ptr());
+    for (int i = 0; i < m_slotCount; i++) {
+        slots()[i].~Slot();
+    }
+    if (m_isGlobal) {
+        s_globalCount--;
+        s_version++;
+    }
+}
+
+malEnv* malEnv::create(const malEnvPtr& outer, int slots)
+{
+    void* memory = allocate(sizeof(malEnv) + slots * sizeof(Slot));
+    return new (memory) malEnv(outer, slots);
+}
+
+// The arguments are checked before the environment is allocated, so that
+// the constructor can't throw.
+malEnv* malEnv::create(const malEnvPtr& outer, const malParams& params,
+                       malValueIter argsBegin, malValueIter argsEnd)
+{
+    int argCount = std::distance(argsBegin, argsEnd);
+    int fixedCount = params.fixedCount();
+    MAL_CHECK(argCount >= fixedCount, "Not enough parameters");
+    if (params.hasRest()) {
+        MAL_CHECK(params.restId() >= 0,
+                  "There must be one parameter after the &");
+    }
+    else {
+        MAL_CHECK(argCount == fixedCount, "Too many parameters");
+    }
+
+    malEnv* env = create(outer, fixedCount + params.hasRest());
+    Slot* slots = env->slots();
+    const int* ids = params.ids();
+    for (int i = 0; i < fixedCount; i++) {
+        new (slots + i) Slot(ids[i], argsBegin[i]);
+        if (isMacro(argsBegin[i])) {
+            bindsMacro(ids[i]);
+        }
+    }
+    if (params.hasRest()) {
+        new (slots + fixedCount) Slot(params.restId(),
+                                      mal::list(argsBegin + fixedCount,
+                                                argsEnd));
+    }
+    env->m_slotCount = env->m_slotCapacity;
+    return env;
 }
 
-malEnvPtr malEnv::find(const String& symbol)
+// The lookups walk the chain with plain pointers, as each environment is
+// kept alive by the one inside it.
+malEnvPtr malEnv::find(const malSymbol* symbol)
 {
-    for (malEnvPtr env = this; env; env = env->m_outer) {
-        if (env->m_map.find(symbol) != env->m_map.end()) {
+    int id = symbol->id();
+    for (malEnv* env = this; env; env = env->m_outer.ptr()) {
+        if (env->binding(id)) {
             return env;
         }
     }
     return NULL;
 }
 
-malValuePtr malEnv::get(const String& symbol)
+malValuePtr malEnv::get(const malSymbol* symbol)
+{
+    if (const malValuePtr* value = lookup(symbol)) {
+        return *value;
+    }
+    MAL_FAIL("'%s' not found", symbol->c_str());
+}
+
+// Returns the binding in place, or NULL if there isn't one, for callers
+// which only need to look at the value while the environment holds it.
+const malValuePtr* malEnv::lookup(const malSymbol* symbol) const
+{
+    if (symbol->m_globalVersion == s_version) {
+        return symbol->m_global;
+    }
+    return lookupUncached(symbol);
+}
+
+const malValuePtr* malEnv::lookupUncached(const malSymbol* symbol) const
 {
-    for (malEnvPtr env = this; env; env = env->m_outer) {
-        auto it = env->m_map.find(symbol);
-        if (it != env->m_map.end()) {
-            return it->second;
+    int id = symbol->id();
+    for (const malEnv* env = this; env; env = env->m_outer.ptr()) {
+        if (const malValuePtr* value = env->binding(id)) {
+            // With only one global environment, this must be it.
+            bool isBoundLocally = (id < (int)s_isBoundLocally.size())
+                                && s_isBoundLocally[id];
+            if (env->m_isGlobal && (s_globalCount == 1) && !isBoundLocally) {
+                symbol->m_global = value;
+                symbol->m_globalVersion = s_version;
+            }
+            return value;
         }
     }
-    MAL_FAIL("'%s' not found", symbol.c_str());
+    return NULL;
 }
 
-malValuePtr malEnv::set(const String& symbol, malValuePtr value)
+void malEnv::bindsLocally(const malSymbol* symbol)
 {
-    m_map[symbol] = value;
+    int id = symbol->id();
+    if (id >= (int)s_isBoundLocally.size()) {
+        s_isBoundLocally.resize(id + 1);
+    }
+    if (!s_isBoundLocally[id]) {
+        s_isBoundLocally[id] = true;
+        s_version++;
+    }
+}
+
+void malEnv::bindsMacro(int id)
+{
+    if (id >= (int)s_namesMacro.size()) {
+        s_namesMacro.resize(id + 1);
+    }
+    s_namesMacro[id] = true;
+}
+
+malValuePtr malEnv::set(const malSymbol* symbol, const malValuePtr& value)
+{
+    if (!m_isGlobal) {
+        bindsLocally(symbol);
+    }
+    int id = symbol->id();
+    if (isMacro(value)) {
+        bindsMacro(id);
+    }
+    if (malValuePtr* existing = binding(id)) {
+        *existing = value;
+    }
+    else if (m_slotCount < m_slotCapacity) {
+        new (slots() + m_slotCount++) Slot(id, value);
+    }
+    else {
+        int capacity = m_map.capacity();
+        m_map[id] = value;
+        if (m_isGlobal && (m_map.capacity() != capacity)) {
+            s_version++;    // the bindings have moved
+        }
+    }
     return value;
 }
 
+malValuePtr malEnv::set(StringView symbol, const malValuePtr& value)
+{
+    return set(STATIC_CAST(malSymbol, mal::symbol(symbol)), value);
+}
+
 malEnvPtr malEnv::getRoot()
 {
     // Work our way down the the global environment.
-    for (malEnvPtr env = this; ; env = env->m_outer) {
+    for (malEnv* env = this; ; env = env->m_outer.ptr()) {
         if (!env->m_outer) {
             return env;
         }
     }
 }
+
+void malEnv::clear()
+{
+    for (int i = 0; i < m_slotCount; i++) {
+        slots()[i].value = NULL;
+    }
+    m_map.clear();
+    m_outer = NULL;
+    if (m_isGlobal) {
+        s_version++;    // the bindings are gone
+    }
+}
@@ -1,29 +1,125 @@
 #ifndef INCLUDE_ENVIRONMENT_H
 #define INCLUDE_ENVIRONMENT_H
 
+#include "Collector.h"
+#include "IdTable.h"
 #include "MAL.h"
+#include "MemStats.h"
+#include "Pool.h"
 
-#include <map>
+#include <vector>
 
-class malEnv : public RefCounted {
-public:
-    malEnv(malEnvPtr outer = NULL);
-    malEnv(malEnvPtr outer,
-           const StringVec& bindings,
-           malValueIter argsBegin,
-           malValueIter argsEnd);
+class malParams;
+class malSymbol;
 
+// An environment holds its bindings in slots allocated along with it,
+// sized for the parameters of a call or the bindings of a let*, which are
+// searched linearly. Any bindings beyond those, such as a def! inside a
+// function body, and all of those in the global environment, go in a
+// table keyed by symbol id.
+//
+// A reference to a name which has never been bound anywhere but the
+// global environment can only find it there, so lookup caches where in
+// the table it is on the symbol, and goes straight there next time.
+// Redefining the name updates it in place, leaving the cache valid.
+// Binding a name locally for the first time, growing the global table, or
+// making or destroying a global environment, bumps the version, which
+// invalidates every cache.
+class malEnv : public RefCounted, public malTracked {
+public:
+    malEnv(const malEnvPtr& outer = NULL);
     ~malEnv();
 
-    malValuePtr get(const String& symbol);
-    malEnvPtr   find(const String& symbol);
-    malValuePtr set(const String& symbol, malValuePtr value);
+    // An environment with room for the given number of bindings in slots.
+    static malEnv* create(const malEnvPtr& outer, int slots);
+
+    // The environment for a call, with the parameters bound to the
+    // arguments.
+    static malEnv* create(const malEnvPtr& outer, const malParams& params,
+                          malValueIter argsBegin, malValueIter argsEnd);
+
+    static void* operator new(size_t size) { return allocate(size); }
+    static void* operator new(size_t size, void* memory) { return memory; }
+    static void operator delete(void* memory) {
+        memStats::destroyed(memStats::KIND_ENV,
+                            pool::sizedAllocation(memory));
+        pool::deallocateSized(memory);
+    }
+
+    malValuePtr get(const malSymbol* symbol);
+    const malValuePtr* lookup(const malSymbol* symbol) const;
+    malEnvPtr   find(const malSymbol* symbol);
+    malValuePtr set(const malSymbol* symbol, const malValuePtr& value);
+    malValuePtr set(StringView symbol, const malValuePtr& value);
     malEnvPtr   getRoot();
 
+    // Notes that a name is bound in an environment other than the global
+    // one, so that references to it aren't cached.
+    static void bindsLocally(const malSymbol* symbol);
+
+    // False if the name, given by its symbol id, has never been bound to a
+    // macro anywhere, so that a list headed by it can't be a macro call.
+    static bool mayNameMacro(int id) {
+        return (id < (int)s_namesMacro.size()) && s_namesMacro[id];
+    }
+
 private:
-    typedef std::map<String, malValuePtr> Map;
-    Map m_map;
+    friend class malCollector;
+
+    struct Slot {
+        Slot(int id, const malValuePtr& value) : id(id), value(value) { }
+
+        int id;                 // malSymbol::id()
+        malValuePtr value;
+    };
+
+    malEnv(const malEnvPtr& outer, int slots);
+
+    static void* allocate(size_t size) {
+        void* memory = pool::allocateSized(size);
+        memStats::created(memStats::KIND_ENV, pool::sizedAllocation(memory));
+        return memory;
+    }
+
+    Slot* slots() const {
+        return reinterpret_cast<Slot*>(const_cast<malEnv*>(this) + 1);
+    }
+
+    // The binding in this environment alone, or NULL. The slots are
+    // searched from the last, so that of two parameters with the same
+    // name, the later one wins.
+    malValuePtr* binding(int id) const {
+        for (Slot* slot = slots() + m_slotCount; slot != slots(); ) {
+            if ((--slot)->id == id) {
+                return &slot->value;
+            }
+        }
+        return m_map.find(id);
+    }
+
+    // Lets the collector see and clear the bindings.
+    template<class Visit>
+    void forEachValue(Visit visit) const {
+        for (int i = 0; i < m_slotCount; i++) {
+            visit(slots()[i].value);
+        }
+        m_map.forEach(visit);
+    }
+    void clear();
+
+    const malValuePtr* lookupUncached(const malSymbol* symbol) const;
+    static void bindsMacro(int id);
+
+    static unsigned s_version;
+    static int s_globalCount;
+    static std::vector<bool> s_isBoundLocally; // by symbol id
+    static std::vector<bool> s_namesMacro;     // by symbol id
+
     malEnvPtr m_outer;
+    const bool m_isGlobal;
+    int m_slotCount;
+    const int m_slotCapacity;
+    IdTable<malValuePtr> m_map; // the bindings which don't fit in the slots
 };
 
 #endif // INCLUDE_ENVIRONMENT_H
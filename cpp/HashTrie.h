@@ -0,0 +1,447 @@
+#ifndef INCLUDE_HASHTRIE_H
+#define INCLUDE_HASHTRIE_H
+
+#include "RefCountedPtr.h"
+
+#include <new>
+#include <stdint.h>
+#include <utility>
+
+// A persistent hash array mapped trie, using the compressed (CHAMP) node
+// layout. assoc and dissoc return a new trie which shares all but the
+// O(log32 n) nodes on the path to the changed entry with the original.
+//
+// Each node has two 32-bit bitmaps, one for the hash fragments which hold
+// an entry directly and one for those which hold a child node. Entries and
+// children are stored in a single allocation after the node header. Keys
+// whose 32-bit hashes are identical end up in a collision node, which is
+// just a list of entries.
+template<class K, class V, class Hash, class Equal>
+class HashTrie {
+    enum {
+        BITS        = 5,
+        MASK        = (1 << BITS) - 1,
+        MAX_DEPTH   = (32 + BITS - 1) / BITS + 1,  // plus a collision node
+    };
+
+    class Node;
+    typedef RefCountedPtr<Node> NodePtr;
+
+public:
+    typedef std::pair<K, V> Entry;
+
+    HashTrie() : m_root(NULL), m_size(0) { }
+
+    HashTrie(const HashTrie& that) : m_root(that.m_root), m_size(that.m_size) {
+        acquire(m_root);
+    }
+
+    HashTrie& operator = (const HashTrie& that) {
+        acquire(that.m_root);
+        release(m_root);
+        m_root = that.m_root;
+        m_size = that.m_size;
+        return *this;
+    }
+
+    ~HashTrie() {
+        release(m_root);
+    }
+
+    int size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const V* find(const K& key) const {
+        uint32_t hash = hashOf(key);
+        const Node* node = m_root;
+        for (int shift = 0; node != NULL; shift += BITS) {
+            if (node->isCollision()) {
+                return node->findCollision(key);
+            }
+            uint32_t bit = bitFor(hash, shift);
+            if (node->m_dataMap & bit) {
+                const Entry& entry = node->entries()[node->dataIndex(bit)];
+                return Equal()(entry.first, key) ? &entry.second : NULL;
+            }
+            if (!(node->m_nodeMap & bit)) {
+                return NULL;
+            }
+            node = node->children()[node->childIndex(bit)].ptr();
+        }
+        return NULL;
+    }
+
+    HashTrie assoc(const K& key, const V& value) const {
+        HashTrie result(*this);
+        result.insert(key, value);
+        return result;
+    }
+
+    HashTrie dissoc(const K& key) const {
+        HashTrie result(*this);
+        result.erase(key);
+        return result;
+    }
+
+    // In-place versions of assoc and dissoc. These still copy the path to
+    // the changed entry, so any other trie sharing nodes is unaffected.
+    void insert(const K& key, const V& value) {
+        if (m_root == NULL) {
+            setRoot(Node::single(key, value));
+            m_size = 1;
+            return;
+        }
+        bool added = false;
+        setRoot(assoc(m_root, key, value, hashOf(key), 0, added));
+        m_size += added ? 1 : 0;
+    }
+
+    void erase(const K& key) {
+        if (m_root == NULL) {
+            return;
+        }
+        bool removed = false;
+        Node* root = dissoc(m_root, key, hashOf(key), 0, removed);
+        if (removed) {
+            setRoot(root);
+            m_size--;
+        }
+    }
+
+    class const_iterator {
+    public:
+        const Entry& operator * () const { return *m_entry; }
+        const Entry* operator -> () const { return m_entry; }
+
+        const_iterator& operator ++ () {
+            advance();
+            return *this;
+        }
+
+        bool operator != (const const_iterator& that) const {
+            return m_entry != that.m_entry;
+        }
+
+        bool operator == (const const_iterator& that) const {
+            return m_entry == that.m_entry;
+        }
+
+    private:
+        friend class HashTrie;
+
+        const_iterator() : m_depth(-1), m_entry(NULL) { }
+
+        explicit const_iterator(const Node* root) : m_depth(-1), m_entry(NULL) {
+            if (root) {
+                push(root);
+                advance();
+            }
+        }
+
+        void push(const Node* node) {
+            Frame& frame = m_stack[++m_depth];
+            frame.node  = node;
+            frame.entry = 0;
+            frame.child = 0;
+        }
+
+        // Entries are visited before children, depth-first.
+        void advance() {
+            while (m_depth >= 0) {
+                Frame& frame = m_stack[m_depth];
+                if (frame.entry < frame.node->m_dataCount) {
+                    m_entry = &frame.node->entries()[frame.entry++];
+                    return;
+                }
+                if (frame.child < frame.node->m_childCount) {
+                    push(frame.node->children()[frame.child++].ptr());
+                    continue;
+                }
+                --m_depth;
+            }
+            m_entry = NULL;
+        }
+
+        struct Frame {
+            const Node* node;
+            int entry;
+            int child;
+        };
+
+        Frame m_stack[MAX_DEPTH];
+        int m_depth;
+        const Entry* m_entry;
+    };
+
+    const_iterator begin() const { return const_iterator(m_root); }
+    const_iterator end()   const { return const_iterator(); }
+
+private:
+    class Node : public RefCounted {
+    public:
+        // Allocates a node with room for the given number of entries and
+        // children, which the caller must construct in place.
+        static Node* create(uint32_t dataMap, uint32_t nodeMap,
+                            int dataCount, int childCount) {
+            size_t size = sizeof(Node)
+                        + dataCount * sizeof(Entry)
+                        + childCount * sizeof(NodePtr);
+            void* memory = ::operator new(size);
+            return new (memory) Node(dataMap, nodeMap, dataCount, childCount);
+        }
+
+        static Node* single(const K& key, const V& value) {
+            Node* node = create(1u << (hashOf(key) & MASK), 0, 1, 0);
+            new (node->entries()) Entry(key, value);
+            return node;
+        }
+
+        ~Node() {
+            for (int i = 0; i < m_dataCount; i++) {
+                entries()[i].~Entry();
+            }
+            for (int i = 0; i < m_childCount; i++) {
+                children()[i].~NodePtr();
+            }
+        }
+
+        static void operator delete(void* memory) {
+            ::operator delete(memory);
+        }
+
+        Entry* entries() const {
+            return reinterpret_cast<Entry*>(const_cast<Node*>(this) + 1);
+        }
+
+        NodePtr* children() const {
+            return reinterpret_cast<NodePtr*>(entries() + m_dataCount);
+        }
+
+        int dataIndex(uint32_t bit) const {
+            return __builtin_popcount(m_dataMap & (bit - 1));
+        }
+
+        int childIndex(uint32_t bit) const {
+            return __builtin_popcount(m_nodeMap & (bit - 1));
+        }
+
+        bool isCollision() const {
+            return (m_dataMap == 0) && (m_nodeMap == 0);
+        }
+
+        const V* findCollision(const K& key) const {
+            for (int i = 0; i < m_dataCount; i++) {
+                if (Equal()(entries()[i].first, key)) {
+                    return &entries()[i].second;
+                }
+            }
+            return NULL;
+        }
+
+        const uint32_t m_dataMap;
+        const uint32_t m_nodeMap;
+        const int m_dataCount;
+        const int m_childCount;
+
+    private:
+        Node(uint32_t dataMap, uint32_t nodeMap, int dataCount, int childCount)
+        : m_dataMap(dataMap), m_nodeMap(nodeMap)
+        , m_dataCount(dataCount), m_childCount(childCount) { }
+    };
+
+    HashTrie(Node* root, int size) : m_root(root), m_size(size) {
+        acquire(m_root);
+    }
+
+    void setRoot(Node* root) {
+        acquire(root);
+        release(m_root);
+        m_root = root;
+    }
+
+    static void acquire(const Node* node) {
+        if (node != NULL) {
+            node->acquire();
+        }
+    }
+
+    static void release(const Node* node) {
+        if ((node != NULL) && (node->release() == 0)) {
+            delete node;
+        }
+    }
+
+    static uint32_t hashOf(const K& key) {
+        uint64_t hash = Hash()(key);
+        return static_cast<uint32_t>(hash ^ (hash >> 32));
+    }
+
+    static uint32_t bitFor(uint32_t hash, int shift) {
+        return 1u << ((hash >> shift) & MASK);
+    }
+
+    // Copies node, replacing, inserting or removing one entry or child.
+    // An index of -1 means no change to that array. Like the other node
+    // operations, this returns a new node with a zero reference count, or
+    // an existing node if nothing changed.
+    static Node* copy(const Node* node, uint32_t dataMap, uint32_t nodeMap,
+                      int entryAt, int entryDelta, const Entry* entry,
+                      int childAt, int childDelta, Node* const* child) {
+        int dataCount  = node->m_dataCount  + entryDelta;
+        int childCount = node->m_childCount + childDelta;
+        Node* result = Node::create(dataMap, nodeMap, dataCount, childCount);
+
+        copyArray(node->entries(), node->m_dataCount, result->entries(),
+                  entryAt, entryDelta, entry);
+        copyArray(node->children(), node->m_childCount, result->children(),
+                  childAt, childDelta, child);
+        return result;
+    }
+
+    template<class T, class Item>
+    static void copyArray(const T* from, int count, T* to,
+                          int at, int delta, const Item* item) {
+        int src = 0;
+        for (int dst = 0; dst < count + delta; dst++) {
+            if (dst == at && delta >= 0) {
+                new (to + dst) T(*item);
+                if (delta == 0) {
+                    src++;
+                }
+                continue;
+            }
+            if (src == at && delta < 0) {
+                src++;
+            }
+            new (to + dst) T(from[src++]);
+        }
+    }
+
+    static Node* merge(const Entry& a, uint32_t hashA,
+                       const Entry& b, uint32_t hashB, int shift) {
+        if (shift >= 32) {
+            Node* node = Node::create(0, 0, 2, 0);
+            new (node->entries())     Entry(a);
+            new (node->entries() + 1) Entry(b);
+            return node;
+        }
+        uint32_t bitA = bitFor(hashA, shift);
+        uint32_t bitB = bitFor(hashB, shift);
+        if (bitA == bitB) {
+            Node* child = merge(a, hashA, b, hashB, shift + BITS);
+            Node* node = Node::create(0, bitA, 0, 1);
+            new (node->children()) NodePtr(child);
+            return node;
+        }
+        Node* node = Node::create(bitA | bitB, 0, 2, 0);
+        bool aFirst = bitA < bitB;
+        new (node->entries())     Entry(aFirst ? a : b);
+        new (node->entries() + 1) Entry(aFirst ? b : a);
+        return node;
+    }
+
+    static Node* assoc(const Node* node, const K& key, const V& value,
+                       uint32_t hash, int shift, bool& added) {
+        Entry entry(key, value);
+        if (node->isCollision()) {
+            for (int i = 0; i < node->m_dataCount; i++) {
+                if (Equal()(node->entries()[i].first, key)) {
+                    return copy(node, 0, 0, i, 0, &entry, -1, 0, NULL);
+                }
+            }
+            added = true;
+            return copy(node, 0, 0, node->m_dataCount, 1, &entry, -1, 0, NULL);
+        }
+
+        uint32_t bit = bitFor(hash, shift);
+        if (node->m_dataMap & bit) {
+            int index = node->dataIndex(bit);
+            const Entry& existing = node->entries()[index];
+            if (Equal()(existing.first, key)) {
+                return copy(node, node->m_dataMap, node->m_nodeMap,
+                            index, 0, &entry, -1, 0, NULL);
+            }
+            // Push both entries down into a new child node.
+            added = true;
+            Node* child = merge(existing, hashOf(existing.first),
+                                entry, hash, shift + BITS);
+            return copy(node, node->m_dataMap ^ bit, node->m_nodeMap | bit,
+                        index, -1, NULL,
+                        __builtin_popcount(node->m_nodeMap & (bit - 1)), 1,
+                        &child);
+        }
+        if (node->m_nodeMap & bit) {
+            int index = node->childIndex(bit);
+            Node* child = assoc(node->children()[index].ptr(),
+                                key, value, hash, shift + BITS, added);
+            return copy(node, node->m_dataMap, node->m_nodeMap,
+                        -1, 0, NULL, index, 0, &child);
+        }
+        added = true;
+        return copy(node, node->m_dataMap | bit, node->m_nodeMap,
+                    node->dataIndex(bit), 1, &entry, -1, 0, NULL);
+    }
+
+    // Returns NULL if the resulting node would be empty.
+    static Node* dissoc(const Node* node, const K& key,
+                        uint32_t hash, int shift, bool& removed) {
+        if (node->isCollision()) {
+            for (int i = 0; i < node->m_dataCount; i++) {
+                if (Equal()(node->entries()[i].first, key)) {
+                    removed = true;
+                    if (node->m_dataCount == 1) {
+                        return NULL;
+                    }
+                    return copy(node, 0, 0, i, -1, NULL, -1, 0, NULL);
+                }
+            }
+            return const_cast<Node*>(node);
+        }
+
+        uint32_t bit = bitFor(hash, shift);
+        if (node->m_dataMap & bit) {
+            int index = node->dataIndex(bit);
+            if (!Equal()(node->entries()[index].first, key)) {
+                return const_cast<Node*>(node);
+            }
+            removed = true;
+            if ((node->m_dataCount == 1) && (node->m_childCount == 0)) {
+                return NULL;
+            }
+            return copy(node, node->m_dataMap ^ bit, node->m_nodeMap,
+                        index, -1, NULL, -1, 0, NULL);
+        }
+        if (node->m_nodeMap & bit) {
+            int index = node->childIndex(bit);
+            const Node* oldChild = node->children()[index].ptr();
+            Node* child = dissoc(oldChild, key, hash, shift + BITS, removed);
+            if (!removed) {
+                return const_cast<Node*>(node);
+            }
+            if (!child) {
+                if ((node->m_dataCount == 0) && (node->m_childCount == 1)) {
+                    return NULL;
+                }
+                return copy(node, node->m_dataMap, node->m_nodeMap ^ bit,
+                            -1, 0, NULL, index, -1, NULL);
+            }
+            if ((child->m_dataCount == 1) && (child->m_childCount == 0)) {
+                // Pull a lone entry back up into this node.
+                Node* result = copy(node, node->m_dataMap | bit,
+                                    node->m_nodeMap ^ bit,
+                                    node->dataIndex(bit), 1, child->entries(),
+                                    index, -1, NULL);
+                delete child;
+                return result;
+            }
+            return copy(node, node->m_dataMap, node->m_nodeMap,
+                        -1, 0, NULL, index, 0, &child);
+        }
+        return const_cast<Node*>(node);
+    }
+
+    Node* m_root;
+    int m_size;
+};
+
+#endif // INCLUDE_HASHTRIE_H
@@ -0,0 +1,156 @@
+#ifndef INCLUDE_IDTABLE_H
+#define INCLUDE_IDTABLE_H
+
+#include "MemStats.h"
+#include "Pool.h"
+
+#include <new>
+#include <stdint.h>
+#include <utility>
+
+// A hash table keyed by non-negative ints, such as malSymbol::id(), with
+// open addressing and linear probing. The entries are kept in a single
+// block from the pool, behind a header holding their count, so an empty
+// table is just a NULL pointer. Nothing is ever removed.
+//
+// Symbol ids are handed out in sequence, so they are used as their own
+// hashes: a run of them fills consecutive entries without colliding.
+//
+// Growing the table moves the entries, so a pointer from find is only good
+// until the next insertion which changes capacity().
+template<class V>
+class IdTable {
+public:
+    IdTable() : m_table(NULL) { }
+    ~IdTable() { clear(); }
+
+    int size() const { return m_table ? m_table->count : 0; }
+    int capacity() const { return m_table ? m_table->mask + 1 : 0; }
+
+    V* find(int id) const {
+        if (!m_table) {
+            return NULL;
+        }
+        Entry* entries = m_table->entries();
+        for (uint32_t i = id; ; i++) {
+            Entry& entry = entries[i & m_table->mask];
+            if (entry.id == id) {
+                return &entry.value;
+            }
+            if (entry.id == EMPTY) {
+                return NULL;
+            }
+        }
+    }
+
+    // The value for the id, added as V() if it isn't there already.
+    V& operator [] (int id) {
+        if (V* value = find(id)) {
+            return *value;
+        }
+        // Keep the table no more than three-quarters full.
+        if ((size() + 1) * 4 > capacity() * 3) {
+            grow();
+        }
+        m_table->count++;
+        Entry& entry = *place(m_table, id);
+        entry.id = id;
+        return entry.value;
+    }
+
+    template<class Visit>
+    void forEach(Visit visit) const {
+        for (int i = 0; i < capacity(); i++) {
+            Entry& entry = m_table->entries()[i];
+            if (entry.id != EMPTY) {
+                visit(entry.value);
+            }
+        }
+    }
+
+    void clear() {
+        if (Table* table = m_table) {
+            m_table = NULL;
+            destroy(table);
+        }
+    }
+
+private:
+    IdTable(const IdTable&);
+    IdTable& operator = (const IdTable&);
+
+    enum {
+        EMPTY           = -1,
+        MIN_CAPACITY    = 8,
+    };
+
+    struct Entry {
+        int id;
+        V value;
+    };
+
+    struct Table {
+        int count;
+        uint32_t mask;          // the capacity, less one
+
+        Entry* entries() { return reinterpret_cast<Entry*>(this + 1); }
+    };
+
+    static size_t bytes(int capacity) {
+        return sizeof(Table) + capacity * sizeof(Entry);
+    }
+
+    static Table* create(int capacity) {
+        size_t size = bytes(capacity);
+        Table* table = static_cast<Table*>(pool::allocate(size));
+        memStats::created(memStats::KIND_ID_TABLE, size);
+        table->count = 0;
+        table->mask = capacity - 1;
+        for (int i = 0; i < capacity; i++) {
+            new (table->entries() + i) Entry();
+            table->entries()[i].id = EMPTY;
+        }
+        return table;
+    }
+
+    static void destroy(Table* table) {
+        int capacity = table->mask + 1;
+        for (int i = 0; i < capacity; i++) {
+            table->entries()[i].~Entry();
+        }
+        memStats::destroyed(memStats::KIND_ID_TABLE, bytes(capacity));
+        pool::deallocate(table, bytes(capacity));
+    }
+
+    // The entry the id belongs in, which must not be in the table yet.
+    static Entry* place(Table* table, int id) {
+        for (uint32_t i = id; ; i++) {
+            Entry* entry = table->entries() + (i & table->mask);
+            if (entry->id == EMPTY) {
+                return entry;
+            }
+        }
+    }
+
+    void grow() {
+        int capacity = m_table ? (m_table->mask + 1) * 2 : MIN_CAPACITY;
+        Table* table = create(capacity);
+        if (m_table) {
+            for (uint32_t i = 0; i <= m_table->mask; i++) {
+                Entry& entry = m_table->entries()[i];
+                if (entry.id != EMPTY) {
+                    Entry* moved = place(table, entry.id);
+                    moved->id = entry.id;
+                    std::swap(moved->value, entry.value);
+                }
+            }
+            table->count = m_table->count;
+            destroy(m_table);
+        }
+        m_table = table;
+    }
+
+    Table* m_table;
+};
+
+#endif // INCLUDE_IDTABLE_H
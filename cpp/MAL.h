@@ -5,6 +5,7 @@
 #include "RefCountedPtr.h"
 #include "String.h"
 #include "Validation.h"
+#include "ValuePtr.h"
 
 #include <vector>
 
@@ -17,16 +18,16 @@ class malEnv;
 typedef RefCountedPtr<malEnv>     malEnvPtr;
 
 // step*.cpp
-extern malValuePtr APPLY(malValuePtr op,
+extern malValuePtr APPLY(const malValuePtr& op,
                          malValueIter argsBegin, malValueIter argsEnd);
-extern malValuePtr EVAL(malValuePtr ast, malEnvPtr env);
+extern malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env);
 extern malValuePtr readline(const String& prompt);
-extern String rep(const String& input, malEnvPtr env);
+extern String rep(const String& input, const malEnvPtr& env);
 
 // Core.cpp
-extern void installCore(malEnvPtr env);
+extern void installCore(const malEnvPtr& env);
 
 // Reader.cpp
-extern malValuePtr readStr(const String& input);
+extern malValuePtr readStr(StringView input);
 
 #endif // INCLUDE_MAL_H
@@ -0,0 +1,25 @@
+#include "MemStats.h"
+
+namespace memStats {
+    Counter counters[KINDS];
+    Counter total;
+
+    const char* const names[KINDS] = {
+        "constant", "integer", "string", "keyword", "symbol",
+        "list-cell", "list-view", "vector", "builtin", "lambda",
+        "hash", "atom", "env", "string-buffer", "rope", "id-table",
+    };
+
+    void report(FILE* out) {
+        fprintf(out, "%-14s %10s %10s %12s %12s\n",
+                "mem-stats", "live", "peak", "bytes", "peak bytes");
+        for (int kind = 0; kind < KINDS; kind++) {
+            const Counter& counter = counters[kind];
+            fprintf(out, "%-14s %10zu %10zu %12zu %12zu\n", names[kind],
+                    counter.live, counter.peak,
+                    counter.bytes, counter.peakBytes);
+        }
+        fprintf(out, "%-14s %10zu %10zu %12zu %12zu\n", "total",
+                total.live, total.peak, total.bytes, total.peakBytes);
+    }
+};
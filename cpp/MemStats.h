@@ -0,0 +1,65 @@
+#ifndef INCLUDE_MEMSTATS_H
+#define INCLUDE_MEMSTATS_H
+
+#include <cstddef>
+#include <cstdio>
+
+// Counts of the live objects of each kind, and the bytes they take, kept
+// up to date as objects are constructed and destroyed, along with the
+// highest each has reached. The (mem-stats) builtin returns them, and
+// stepA_mal --mem-stats reports them on stderr at exit.
+//
+// The bytes are those of the objects themselves, and their items where
+// those are allocated along with them. Memory held through std containers
+// isn't counted.
+namespace memStats {
+    // The first VALUE_KINDS kinds are the malValue types, in order.
+    enum Kind {
+        VALUE_KINDS     = 12,
+        KIND_ENV        = VALUE_KINDS,
+        KIND_STRING_BUFFER,
+        KIND_ROPE,
+        KIND_ID_TABLE,
+        KINDS,
+    };
+
+    struct Counter {
+        size_t live;
+        size_t peak;
+        size_t bytes;
+        size_t peakBytes;
+    };
+
+    extern Counter counters[KINDS];
+    extern Counter total;
+    extern const char* const names[KINDS];
+
+    inline void add(Counter& counter, size_t bytes) {
+        if (++counter.live > counter.peak) {
+            counter.peak = counter.live;
+        }
+        counter.bytes += bytes;
+        if (counter.bytes > counter.peakBytes) {
+            counter.peakBytes = counter.bytes;
+        }
+    }
+
+    inline void remove(Counter& counter, size_t bytes) {
+        counter.live--;
+        counter.bytes -= bytes;
+    }
+
+    inline void created(int kind, size_t bytes) {
+        add(counters[kind], bytes);
+        add(total, bytes);
+    }
+
+    inline void destroyed(int kind, size_t bytes) {
+        remove(counters[kind], bytes);
+        remove(total, bytes);
+    }
+
+    void report(FILE* out);
+};
+
+#endif // INCLUDE_MEMSTATS_H
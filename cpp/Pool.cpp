@@ -0,0 +1,34 @@
+#include "Pool.h"
+
+namespace pool {
+    FreeBlock* freeLists[CLASSES];
+    Stats stats;
+
+    void* refill(int sizeClass) {
+        size_t blockSize = (sizeClass + 1) * GRANULE;
+        char* chunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+        stats.retained += CHUNK_SIZE;
+
+        // The first block is returned, and the rest go on the free list.
+        FreeBlock* head = freeLists[sizeClass];
+        for (size_t offset = CHUNK_SIZE / blockSize * blockSize - blockSize;
+             offset > 0; offset -= blockSize) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + offset);
+            block->next = head;
+            head = block;
+        }
+        freeLists[sizeClass] = head;
+        return chunk;
+    }
+
+    void* allocateSized(size_t size) {
+        size_t* header = static_cast<size_t*>(allocate(sizeof(size_t) + size));
+        *header = sizeof(size_t) + size;
+        return header + 1;
+    }
+
+    void deallocateSized(void* memory) {
+        size_t* header = static_cast<size_t*>(memory) - 1;
+        deallocate(header, *header);
+    }
+};
@@ -0,0 +1,88 @@
+#ifndef INCLUDE_POOL_H
+#define INCLUDE_POOL_H
+
+#include <cstddef>
+#include <new>
+
+// Free lists of fixed-size blocks, one for each multiple of GRANULE bytes
+// up to MAX_SIZE, which malValue and malEnv allocate from through their
+// class operator new and delete. A freed block goes back on its free list
+// rather than to malloc, and the pools never give memory back.
+//
+// Building with POOL_USE_MALLOC (make POOL=malloc) sends every allocation
+// straight to malloc instead, so that ASan and valgrind see each object.
+namespace pool {
+    enum {
+        GRANULE     = 8,
+        MAX_SIZE    = 256,
+        CLASSES     = MAX_SIZE / GRANULE,
+        CHUNK_SIZE  = 64 * 1024,
+    };
+
+    struct Stats {
+        size_t hits;        // allocations served from a free list
+        size_t misses;      // allocations which needed fresh memory
+        size_t retained;    // bytes held by the pools, in use or free
+        size_t inUse;       // bytes allocated and not yet freed
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    extern FreeBlock* freeLists[CLASSES];
+    extern Stats stats;
+
+    // Carves a new chunk into blocks of the given size class, and returns
+    // the first of them.
+    void* refill(int sizeClass);
+
+    inline void* allocate(size_t size) {
+#if !POOL_USE_MALLOC
+        if (size <= MAX_SIZE) {
+            int sizeClass = (size - 1) / GRANULE;
+            FreeBlock* block = freeLists[sizeClass];
+            if (block != NULL) {
+                freeLists[sizeClass] = block->next;
+                stats.hits++;
+                stats.inUse += (sizeClass + 1) * GRANULE;
+                return block;
+            }
+            stats.misses++;
+            stats.inUse += (sizeClass + 1) * GRANULE;
+            return refill(sizeClass);
+        }
+#endif
+        stats.misses++;
+        stats.inUse += size;
+        return ::operator new(size);
+    }
+
+    inline void deallocate(void* memory, size_t size) {
+#if !POOL_USE_MALLOC
+        if (size <= MAX_SIZE) {
+            FreeBlock* block = static_cast<FreeBlock*>(memory);
+            int sizeClass = (size - 1) / GRANULE;
+            block->next = freeLists[sizeClass];
+            freeLists[sizeClass] = block;
+            stats.inUse -= (sizeClass + 1) * GRANULE;
+            return;
+        }
+#endif
+        stats.inUse -= size;
+        ::operator delete(memory);
+    }
+
+    // For objects with items allocated after them, whose class operator
+    // delete is only told the size of the object itself. The full size is
+    // kept in front of the object instead.
+    void* allocateSized(size_t size);
+    void deallocateSized(void* memory);
+
+    // The full size of a block from allocateSized, header included.
+    inline size_t sizedAllocation(const void* memory) {
+        return static_cast<const size_t*>(memory)[-1];
+    }
+};
+
+#endif // INCLUDE_POOL_H
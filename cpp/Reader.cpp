@@ -19,7 +19,7 @@ static const Regex tokenRegexes[] = {
 class Tokeniser
 {
 public:
-    Tokeniser(const String& input);
+    Tokeniser(StringView input);
 
     String peek() const {
         ASSERT(!eof(), "Tokeniser reading past EOF in peek\n");
@@ -43,14 +43,14 @@ private:
 
     bool matchRegex(const Regex& regex);
 
-    typedef String::const_iterator StringIter;
+    typedef const char* StringIter;
 
     String      m_token;
     StringIter  m_iter;
     StringIter  m_end;
 };
 
-Tokeniser::Tokeniser(const String& input)
+Tokeniser::Tokeniser(StringView input)
 :   m_iter(input.begin())
 ,   m_end(input.end())
 {
@@ -63,7 +63,7 @@ bool Tokeniser::matchRegex(const Regex& regex)
         return false;
     }
 
-    std::smatch match;
+    std::cmatch match;
     auto flags = std::regex_constants::match_continuous;
     if (!std::regex_search(m_iter, m_end, match, regex, flags)) {
         return false;
@@ -118,7 +118,7 @@ static void readList(Tokeniser& tokeniser, malValueVec* items,
                       const String& end);
 static malValuePtr processMacro(Tokeniser& tokeniser, const String& symbol);
 
-malValuePtr readStr(const String& input)
+malValuePtr readStr(StringView input)
 {
     Tokeniser tokeniser(input);
     if (tokeniser.eof()) {
@@ -0,0 +1,19 @@
+#include "RefCountedPtr.h"
+
+#if COUNT_REFS
+
+RefCounts refCounts;
+
+// Reports the totals once the program has finished.
+static struct RefCountReport {
+    ~RefCountReport() {
+        fprintf(stderr, "refcounts: %zu acquires, %zu releases, "
+                        "%.1f acquires per eval step\n",
+                refCounts.acquires, refCounts.releases,
+                refCounts.evals ? double(refCounts.acquires) / refCounts.evals
+                                : 0.0);
+        fprintf(stderr, "strings: %zu copies\n", refCounts.stringCopies);
+    }
+} refCountReport;
+
+#endif
@@ -5,13 +5,37 @@
 
 #include <cstddef>
 
+// Building with COUNT_REFS (make COUNT_REFS=1) counts every acquire and
+// release, and reports the totals on stderr at exit.
+#if COUNT_REFS
+    struct RefCounts {
+        size_t acquires;
+        size_t releases;
+        size_t evals;       // steps taken by EVAL
+        size_t stringCopies;
+    };
+    extern RefCounts refCounts;
+
+    #define COUNT_REF(counter)  (refCounts.counter++)
+#else
+    #define COUNT_REF(counter)  NOOP
+#endif
+
 class RefCounted {
 public:
     RefCounted() : m_refCount(0) { }
     virtual ~RefCounted() { }
 
-    const RefCounted* acquire() const { m_refCount++; return this; }
-    int release() const { return --m_refCount; }
+    const RefCounted* acquire() const {
+        COUNT_REF(acquires);
+        m_refCount++;
+        return this;
+    }
+
+    int release() const {
+        COUNT_REF(releases);
+        return --m_refCount;
+    }
     int refCount() const { return m_refCount; }
 
 private:
@@ -32,11 +56,22 @@ public:
     RefCountedPtr(const RefCountedPtr& rhs) : m_object(0)
     { acquire(rhs.m_object); }
 
+    RefCountedPtr(RefCountedPtr&& rhs) : m_object(rhs.m_object)
+    { rhs.m_object = 0; }
+
     const RefCountedPtr& operator = (const RefCountedPtr& rhs) {
         acquire(rhs.m_object);
         return *this;
     }
 
+    const RefCountedPtr& operator = (RefCountedPtr&& rhs) {
+        T* object = rhs.m_object;
+        rhs.m_object = 0; // before release, in case rhs is owned by us
+        release();
+        m_object = object;
+        return *this;
+    }
+
     bool operator == (const RefCountedPtr& rhs) const {
         return m_object == rhs.m_object;
     }
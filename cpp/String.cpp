@@ -1,7 +1,9 @@
 #include "Debug.h"
+#include "RefCountedPtr.h"
 #include "String.h"
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +30,23 @@ String stringPrintf(const char* fmt, ...) {
     return str;
 }
 
+String StringView::str() const
+{
+    COUNT_REF(stringCopies);
+    return String(m_data, m_size);
+}
+
+// FNV-1a, which is short and good enough for hash map keys.
+size_t StringViewHash::operator () (StringView chars) const
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (char c : chars) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
 String copyAndFree(char* mallocedString)
 {
     String ret(mallocedString);
@@ -35,11 +54,21 @@ String copyAndFree(char* mallocedString)
     return ret;
 }
 
-String escape(const String& in)
+String escape(StringView in)
 {
     String out;
     out.reserve(in.size() * 2 + 2); // each char may get escaped + two "'s
     out += '"';
+    appendEscaped(out, in);
+    out += '"';
+    out.shrink_to_fit();
+    return out;
+}
+
+// Escapes in without the surrounding quotes, so that a string can be
+// escaped a piece at a time.
+void appendEscaped(String& out, StringView in)
+{
     for (auto it = in.begin(), end = in.end(); it != end; ++it) {
         char c = *it;
         switch (c) {
@@ -49,9 +78,6 @@ String escape(const String& in)
             default:   out += c;      break;
         };
     }
-    out += '"';
-    out.shrink_to_fit();
-    return out;
 }
 
 static char unescape(char c)
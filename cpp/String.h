@@ -1,18 +1,60 @@
 #ifndef INCLUDE_STRING_H
 #define INCLUDE_STRING_H
 
+#include <cstring>
 #include <string>
 #include <vector>
 
 typedef std::string         String;
 typedef std::vector<String> StringVec;
 
+// Characters held somewhere else, such as in a malStringBase's buffer,
+// which must outlive the view. Copying the characters out, with str(), is
+// counted by COUNT_REFS builds.
+class StringView {
+public:
+    StringView(const char* data, size_t size) : m_data(data), m_size(size) { }
+    StringView(const char* chars) : m_data(chars), m_size(strlen(chars)) { }
+    StringView(const String& str) : m_data(str.data()), m_size(str.size()) { }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+
+    StringView substr(size_t pos, size_t count) const {
+        return StringView(m_data + pos, count);
+    }
+
+    String str() const;
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+inline bool operator == (StringView lhs, StringView rhs) {
+    return (lhs.size() == rhs.size())
+        && (memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+}
+
+inline bool operator != (StringView lhs, StringView rhs) {
+    return !(lhs == rhs);
+}
+
+struct StringViewHash {
+    size_t operator () (StringView chars) const;
+};
+
 #define STRF        stringPrintf
 #define PLURAL(n)   &("s"[(n)==1])
 
 extern String stringPrintf(const char* fmt, ...);
 extern String copyAndFree(char* mallocedString);
-extern String escape(const String& s);
+extern String escape(StringView s);
+extern void appendEscaped(String& out, StringView s);
 extern String unescape(const String& s);
 
 #endif // INCLUDE_STRING_H
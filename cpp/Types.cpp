@@ -1,13 +1,14 @@
+#include "ArgStack.h"
 #include "Debug.h"
 #include "Environment.h"
 #include "Types.h"
 
 #include <algorithm>
 #include <memory>
-#include <typeinfo>
+#include <unordered_map>
 
 namespace mal {
-    malValuePtr atom(malValuePtr value) {
+    malValuePtr atom(const malValuePtr& value) {
         return malValuePtr(new malAtom(value));
     };
 
@@ -19,9 +20,21 @@ namespace mal {
         return malValuePtr(new malBuiltIn(name, handler));
     };
 
+    malValuePtr cons(const malValuePtr& first, const malValuePtr& rest) {
+        // Anything other than a list is copied into one, so that the
+        // result is a list all the way down.
+        if (!DYNAMIC_CAST(malList, rest)) {
+            const malSequence* seq = VALUE_CAST(malSequence, rest);
+            return malValuePtr(new malListCell(first,
+                list(new malValueVec(seq->begin(), seq->end()))));
+        }
+        return malValuePtr(new malListCell(first, rest));
+    };
+
+    malConstant constants[3] = { {"nil"}, {"true"}, {"false"} };
+
     malValuePtr falseValue() {
-        static malValuePtr c(new malConstant("false"));
-        return malValuePtr(c);
+        return malValuePtr::constant(malValuePtr::TAG_FALSE);
     };
 
 
@@ -35,6 +48,9 @@ namespace mal {
     }
 
     malValuePtr integer(int64_t value) {
+        if (malValuePtr::isImmediateInteger(value)) {
+            return malValuePtr::integer(value);
+        }
         return malValuePtr(new malInteger(value));
     };
 
@@ -42,42 +58,58 @@ namespace mal {
         return integer(std::stoi(token));
     };
 
-    malValuePtr keyword(const String& token) {
-        return malValuePtr(new malKeyword(token));
+    malValuePtr keyword(StringView token) {
+        // Keyed by the keyword's own characters.
+        typedef std::unordered_map<StringView, malValuePtr, StringViewHash>
+            KeywordTable;
+        static KeywordTable table;
+
+        auto it = table.find(token);
+        if (it != table.end()) {
+            return it->second;
+        }
+        malKeyword* keyword = new malKeyword(token);
+        table.emplace(keyword->value(), keyword);
+        return keyword;
     };
 
-    malValuePtr lambda(const StringVec& bindings,
-                       malValuePtr body, malEnvPtr env) {
+    malValuePtr lambda(const malValueVec& bindings,
+                       const malValuePtr& body, const malEnvPtr& env) {
         return malValuePtr(new malLambda(bindings, body, env));
     }
 
+    malValuePtr list() {
+        static const malValuePtr empty(new malListCell);
+        return empty;
+    };
+
     malValuePtr list(malValueVec* items) {
-        return malValuePtr(new malList(items));
+        std::unique_ptr<malValueVec> owned(items);
+        return list(items->begin(), items->end());
     };
 
     malValuePtr list(malValueIter begin, malValueIter end) {
-        return malValuePtr(new malList(begin, end));
+        if (begin == end) {
+            return list();
+        }
+        return malValuePtr(malListView::create(&*begin, end - begin));
     };
 
-    malValuePtr list(malValuePtr a) {
-        malValueVec* items = new malValueVec(1);
-        items->at(0) = a;
-        return malValuePtr(new malList(items));
+    // Short lists are built by the reader and the quasiquote expansion, so
+    // they're made in a single allocation of exactly the right size.
+    malValuePtr list(const malValuePtr& a) {
+        return malValuePtr(malListView::create(&a, 1));
     }
 
-    malValuePtr list(malValuePtr a, malValuePtr b) {
-        malValueVec* items = new malValueVec(2);
-        items->at(0) = a;
-        items->at(1) = b;
-        return malValuePtr(new malList(items));
+    malValuePtr list(const malValuePtr& a, const malValuePtr& b) {
+        const malValuePtr items[] = { a, b };
+        return malValuePtr(malListView::create(items, 2));
     }
 
-    malValuePtr list(malValuePtr a, malValuePtr b, malValuePtr c) {
-        malValueVec* items = new malValueVec(3);
-        items->at(0) = a;
-        items->at(1) = b;
-        items->at(2) = c;
-        return malValuePtr(new malList(items));
+    malValuePtr list(const malValuePtr& a, const malValuePtr& b,
+                     const malValuePtr& c) {
+        const malValuePtr items[] = { a, b, c };
+        return malValuePtr(malListView::create(items, 3));
     }
 
     malValuePtr macro(const malLambda& lambda) {
@@ -85,29 +117,78 @@ namespace mal {
     };
 
     malValuePtr nilValue() {
-        static malValuePtr c(new malConstant("nil"));
-        return malValuePtr(c);
+        return malValuePtr::constant(malValuePtr::TAG_NIL);
     };
 
-    malValuePtr string(const String& token) {
+    malValuePtr string(StringView token) {
         return malValuePtr(new malString(token));
     }
 
-    malValuePtr symbol(const String& token) {
-        return malValuePtr(new malSymbol(token));
+    malValuePtr string(const malRopePtr& rope) {
+        return malValuePtr(new malString(rope));
+    }
+
+    malValuePtr symbol(StringView token) {
+        // Symbols live for the life of the process, so that an id is
+        // never reused for a different name. Keyed by the symbol's own
+        // characters.
+        typedef std::unordered_map<StringView, malValuePtr, StringViewHash>
+            SymbolTable;
+        static SymbolTable table;
+
+        auto intern = [](StringView name) {
+            malSymbol* symbol = new malSymbol(name, table.size());
+            table.emplace(symbol->value(), symbol);
+            return symbol;
+        };
+
+        if (table.empty()) {
+            // In the order of the SpecialForm ids.
+            static const char* const specialForms[] = {
+                "catch*", "def!", "defmacro!", "do", "fn*", "if", "let*",
+                "macroexpand", "quasiquote", "quote", "try*",
+            };
+            static_assert(sizeof(specialForms) / sizeof(specialForms[0])
+                            == SPECIAL_FORMS,
+                          "a name is needed for each special form");
+            for (const char* name : specialForms) {
+                intern(name);
+            }
+        }
+
+        auto it = table.find(token);
+        if (it != table.end()) {
+            return it->second;
+        }
+        return malValuePtr(intern(token));
     };
 
     malValuePtr trueValue() {
-        static malValuePtr c(new malConstant("true"));
-        return malValuePtr(c);
+        return malValuePtr::constant(malValuePtr::TAG_TRUE);
+    };
+
+    malValuePtr vector() {
+        static const malValuePtr empty(
+            malVector::create(malVector::Trie(), NULL, 0));
+        return empty;
     };
 
     malValuePtr vector(malValueVec* items) {
-        return malValuePtr(new malVector(items));
+        std::unique_ptr<malValueVec> owned(items);
+        return vector(items->begin(), items->end());
     };
 
     malValuePtr vector(malValueIter begin, malValueIter end) {
-        return malValuePtr(new malVector(begin, end));
+        int count = end - begin;
+        if (count == 0) {
+            return vector();
+        }
+        // The tail takes the last 1-32 items, and the trie the rest.
+        int leafCount = (count - 1) / malVector::Trie::LEAF_SIZE;
+        malVector::Trie trie(begin, leafCount);
+        int trieSize = trie.size();
+        return malValuePtr(malVector::create(trie, &begin[trieSize],
+                                             count - trieSize));
     };
 };
 
@@ -117,24 +198,20 @@ malValuePtr malBuiltIn::apply(malValueIter argsBegin,
     return m_handler(m_name, argsBegin, argsEnd);
 }
 
-static String makeHashKey(malValuePtr key)
+static const malValuePtr& checkHashKey(const malValuePtr& key)
 {
-    if (const malString* skey = DYNAMIC_CAST(malString, key)) {
-        return skey->print(true);
-    }
-    else if (const malKeyword* kkey = DYNAMIC_CAST(malKeyword, key)) {
-        return kkey->print(true);
-    }
-    MAL_FAIL("%s is not a string or keyword", key->print(true).c_str());
+    MAL_CHECK(DYNAMIC_CAST(malString, key) || DYNAMIC_CAST(malKeyword, key),
+              "%s is not a string or keyword", key->print(true).c_str());
+    return key;
 }
 
-static malHash::Map addToMap(malHash::Map& map,
+static malHash::Map addToMap(malHash::Map map,
     malValueIter argsBegin, malValueIter argsEnd)
 {
     // This is intended to be called with pre-evaluated arguments.
     for (auto it = argsBegin; it != argsEnd; ++it) {
-        String key = makeHashKey(*it++);
-        map[key] = *it;
+        const malValuePtr& key = checkHashKey(*it++);
+        map.insert(key, *it);
     }
 
     return map;
@@ -145,19 +222,20 @@ static malHash::Map createMap(malValueIter argsBegin, malValueIter argsEnd)
     MAL_CHECK(std::distance(argsBegin, argsEnd) % 2 == 0,
             "hash-map requires an even-sized list");
 
-    malHash::Map map;
-    return addToMap(map, argsBegin, argsEnd);
+    return addToMap(malHash::Map(), argsBegin, argsEnd);
 }
 
 malHash::malHash(malValueIter argsBegin, malValueIter argsEnd, bool isEvaluated)
-: m_map(createMap(argsBegin, argsEnd))
+: malValue(TYPE_HASH)
+, m_map(createMap(argsBegin, argsEnd))
 , m_isEvaluated(isEvaluated)
 {
 
 }
 
 malHash::malHash(const malHash::Map& map)
-: m_map(map)
+: malValue(TYPE_HASH)
+, m_map(map)
 , m_isEvaluated(true)
 {
 
@@ -169,14 +247,12 @@ malHash::assoc(malValueIter argsBegin, malValueIter argsEnd) const
     MAL_CHECK(std::distance(argsBegin, argsEnd) % 2 == 0,
             "assoc requires an even-sized list");
 
-    malHash::Map map(m_map);
-    return mal::hash(addToMap(map, argsBegin, argsEnd));
+    return mal::hash(addToMap(m_map, argsBegin, argsEnd));
 }
 
-bool malHash::contains(malValuePtr key) const
+bool malHash::contains(const malValuePtr& key) const
 {
-    auto it = m_map.find(makeHashKey(key));
-    return it != m_map.end();
+    return m_map.find(checkHashKey(key)) != NULL;
 }
 
 malValuePtr
@@ -184,13 +260,12 @@ malHash::dissoc(malValueIter argsBegin, malValueIter argsEnd) const
 {
     malHash::Map map(m_map);
     for (auto it = argsBegin; it != argsEnd; ++it) {
-        String key = makeHashKey(*it);
-        map.erase(key);
+        map.erase(checkHashKey(*it));
     }
     return mal::hash(map);
 }
 
-malValuePtr malHash::eval(malEnvPtr env)
+malValuePtr malHash::eval(const malEnvPtr& env)
 {
     if (m_isEvaluated) {
         return malValuePtr(this);
@@ -198,15 +273,15 @@ malValuePtr malHash::eval(malEnvPtr env)
 
     malHash::Map map;
     for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
-        map[it->first] = EVAL(it->second, env);
+        map.insert(it->first, EVAL(it->second, env));
     }
     return mal::hash(map);
 }
 
-malValuePtr malHash::get(malValuePtr key) const
+malValuePtr malHash::get(const malValuePtr& key) const
 {
-    auto it = m_map.find(makeHashKey(key));
-    return it == m_map.end() ? mal::nilValue() : it->second;
+    const malValuePtr* value = m_map.find(checkHashKey(key));
+    return value == NULL ? mal::nilValue() : *value;
 }
 
 malValuePtr malHash::keys() const
@@ -214,12 +289,7 @@ malValuePtr malHash::keys() const
     malValueVec* keys = new malValueVec();
     keys->reserve(m_map.size());
     for (auto it = m_map.begin(), end = m_map.end(); it != end; ++it) {
-        if (it->first[0] == '"') {
-            keys->push_back(mal::string(unescape(it->first)));
-        }
-        else {
-            keys->push_back(mal::keyword(it->first));
-        }
+        keys->push_back(it->first);
     }
     return mal::list(keys);
 }
@@ -240,11 +310,16 @@ String malHash::print(bool readably) const
 
     auto it = m_map.begin(), end = m_map.end();
     if (it != end) {
-        s += it->first + " " + it->second->print(readably);
+        printTo(s, it->first, readably);
+        s += " ";
+        printTo(s, it->second, readably);
         ++it;
     }
     for ( ; it != end; ++it) {
-        s += " " + it->first + " " + it->second->print(readably);
+        s += " ";
+        printTo(s, it->first, readably);
+        s += " ";
+        printTo(s, it->second, readably);
     }
 
     return s + "}";
@@ -257,79 +332,111 @@ bool malHash::doIsEqualTo(const malValue* rhs) const
         return false;
     }
 
-    for (auto it0 = m_map.begin(), end0 = m_map.end(), it1 = r_map.begin();
-         it0 != end0; ++it0, ++it1) {
-
-        if (it0->first != it1->first) {
+    for (auto it0 = m_map.begin(), end0 = m_map.end(); it0 != end0; ++it0) {
+        const malValuePtr* value = r_map.find(it0->first);
+        if (value == NULL) {
             return false;
         }
-        if (!it0->second->isEqualTo(it1->second.ptr())) {
+        if (!it0->second->isEqualTo(*value)) {
             return false;
         }
     }
     return true;
 }
 
-malLambda::malLambda(const StringVec& bindings,
-                     malValuePtr body, malEnvPtr env)
-: m_bindings(bindings)
+unsigned malLambda::s_lastMacroId = 0;
+
+malLambda::malLambda(const malValueVec& bindings,
+                     const malValuePtr& body, const malEnvPtr& env)
+: malApplicable(TYPE_LAMBDA)
+, malTracked(TRACKED_LAMBDA)
+, m_params(malParams::create(bindings))
 , m_body(body)
 , m_env(env)
 , m_isMacro(false)
+, m_macroId(0)
 {
 
 }
 
-malLambda::malLambda(const malLambda& that, malValuePtr meta)
-: malApplicable(meta)
-, m_bindings(that.m_bindings)
+malLambda::malLambda(const malLambda& that, const malValuePtr& meta)
+: malApplicable(TYPE_LAMBDA, meta)
+, malTracked(TRACKED_LAMBDA)
+, m_params(that.m_params)
 , m_body(that.m_body)
 , m_env(that.m_env)
 , m_isMacro(that.m_isMacro)
+, m_macroId(that.m_macroId)
 {
 
 }
 
 malLambda::malLambda(const malLambda& that, bool isMacro)
-: malApplicable(that.m_meta)
-, m_bindings(that.m_bindings)
+: malApplicable(TYPE_LAMBDA, that.meta())
+, malTracked(TRACKED_LAMBDA)
+, m_params(that.m_params)
 , m_body(that.m_body)
 , m_env(that.m_env)
 , m_isMacro(isMacro)
+, m_macroId(isMacro ? ++s_lastMacroId : 0)
 {
 
 }
 
+malParams* malParams::create(const malValueVec& bindings)
+{
+    static const int ampersand =
+        STATIC_CAST(malSymbol, mal::symbol("&"))->id();
+    int count = bindings.size();
+    int fixedCount = 0;
+    while ((fixedCount < count) &&
+           (STATIC_CAST(malSymbol, bindings[fixedCount])->id() != ampersand)) {
+        fixedCount++;
+    }
+    bool hasRest = fixedCount < count;
+    int restId = (fixedCount == count - 2)
+        ? STATIC_CAST(malSymbol, bindings[count - 1])->id() : -1;
+
+    void* memory = pool::allocateSized(sizeof(malParams)
+                                       + fixedCount * sizeof(int));
+    malParams* params = new (memory) malParams(fixedCount, hasRest, restId);
+    for (int i = 0; i < fixedCount; i++) {
+        params->ids()[i] = STATIC_CAST(malSymbol, bindings[i])->id();
+    }
+    for (auto& binding : bindings) {
+        malEnv::bindsLocally(STATIC_CAST(malSymbol, binding));
+    }
+    return params;
+}
+
 malValuePtr malLambda::apply(malValueIter argsBegin,
                              malValueIter argsEnd) const
 {
     return EVAL(m_body, makeEnv(argsBegin, argsEnd));
 }
 
-malValuePtr malLambda::doWithMeta(malValuePtr meta) const
+malValuePtr malLambda::doWithMeta(const malValuePtr& meta) const
 {
     return new malLambda(*this, meta);
 }
 
 malEnvPtr malLambda::makeEnv(malValueIter argsBegin, malValueIter argsEnd) const
 {
-    return malEnvPtr(new malEnv(m_env, m_bindings, argsBegin, argsEnd));
+    malCollector::safePoint();
+    return malEnvPtr(malEnv::create(m_env, *m_params.ptr(), argsBegin, argsEnd));
 }
 
 malValuePtr malList::conj(malValueIter argsBegin,
                           malValueIter argsEnd) const
 {
-    int oldItemCount = std::distance(begin(), end());
-    int newItemCount = std::distance(argsBegin, argsEnd);
-
-    malValueVec* items = new malValueVec(oldItemCount + newItemCount);
-    std::reverse_copy(argsBegin, argsEnd, items->begin());
-    std::copy(begin(), end(), items->begin() + newItemCount);
-
-    return mal::list(items);
+    malValuePtr list(const_cast<malList*>(this));
+    for (auto it = argsBegin; it != argsEnd; ++it) {
+        list = malValuePtr(new malListCell(*it, list));
+    }
+    return list;
 }
 
-malValuePtr malList::eval(malEnvPtr env)
+malValuePtr malList::eval(const malEnvPtr& env)
 {
     // Note, this isn't actually called since the TCO updates, but
     // is required for the earlier steps, so don't get rid of it.
@@ -337,10 +444,9 @@ malValuePtr malList::eval(malEnvPtr env)
         return malValuePtr(this);
     }
 
-    std::unique_ptr<malValueVec> items(evalItems(env));
-    auto it = items->begin();
-    malValuePtr op = *it;
-    return APPLY(op, ++it, items->end());
+    malArgs items(count());
+    evalItems(items.begin(), env);
+    return APPLY(items[0], items.begin() + 1, items.end());
 }
 
 String malList::print(bool readably) const
@@ -348,7 +454,125 @@ String malList::print(bool readably) const
     return '(' + malSequence::print(readably) + ')';
 }
 
-malValuePtr malValue::eval(malEnvPtr env)
+malListCell::malListCell(const malValuePtr& first, const malValuePtr& rest)
+: malList(TYPE_LIST_CELL,
+          rest ? 1 + STATIC_CAST(malList, rest)->count() : 1)
+, m_first(first)
+, m_rest(rest)
+{
+
+}
+
+malListCell::~malListCell()
+{
+    // Free the rest of the list iteratively, as releasing it recursively
+    // would use one stack frame per cell.
+    malValuePtr next = m_rest;
+    m_rest = NULL;
+    while (next && (next.ptr()->refCount() == 1)) {
+        malListCell* cell = DYNAMIC_CAST(malListCell, next);
+        if (!cell) {
+            break;
+        }
+        malValuePtr after = cell->m_rest;
+        cell->m_rest = NULL;
+        next = after;
+    }
+}
+
+const malValuePtr& malListCell::item(int index) const
+{
+    const malListCell* cell = this;
+    for ( ; index > 0; index--) {
+        const malValuePtr& rest = cell->m_rest;
+        cell = DYNAMIC_CAST(malListCell, rest);
+        if (!cell) {
+            return STATIC_CAST(malList, rest)->item(index - 1);
+        }
+    }
+    return cell->m_first;
+}
+
+void malListCell::nextRun(iterator& it, int index) const
+{
+    if ((index > 0) || isEmpty()) {
+        setRun(it, NULL, 0, NULL, 0);
+    }
+    else if (m_rest) {
+        setRun(it, &m_first, 1, STATIC_CAST(malList, m_rest), 0);
+    }
+    else {
+        setRun(it, &m_first, 1, this, 1);
+    }
+}
+
+malValuePtr malListCell::rest() const
+{
+    return m_rest ? m_rest : mal::list();
+}
+
+malListView* malListView::create(const malValuePtr* items, int count)
+{
+    void* memory = pool::allocateSized(sizeof(malListView)
+                                       + count * sizeof(malValuePtr));
+    malValuePtr* storage = reinterpret_cast<malValuePtr*>(
+                                static_cast<malListView*>(memory) + 1);
+    std::uninitialized_copy(items, items + count, storage);
+    return new (memory) malListView(NULL, storage, count);
+}
+
+malListView::~malListView()
+{
+    if (!m_owner) {
+        for (int i = 0; i < count(); i++) {
+            m_items[i].~malValuePtr();
+        }
+    }
+}
+
+malValuePtr malListView::owner() const
+{
+    return m_owner ? m_owner : malValuePtr(const_cast<malListView*>(this));
+}
+
+malValuePtr malListView::rest() const
+{
+    if (count() <= 1) {
+        return mal::list();
+    }
+    return malValuePtr(new malListView(owner(), m_items + 1, count() - 1));
+}
+
+void malListView::nextRun(iterator& it, int index) const
+{
+    setRun(it, m_items + index, count() - index, this, count());
+}
+
+malValuePtr malConstant::eval(const malEnvPtr& env)
+{
+    // The singletons are only ever referred to by their immediate tags.
+    static const uintptr_t tags[] = {
+        malValuePtr::TAG_NIL, malValuePtr::TAG_TRUE, malValuePtr::TAG_FALSE,
+    };
+    for (int i = 0; i < 3; i++) {
+        if (this == &mal::constants[i]) {
+            return malValuePtr::constant(tags[i]);
+        }
+    }
+    return malValuePtr(this);
+}
+
+malValuePtr malInteger::eval(const malEnvPtr& env)
+{
+    // This may be the temporary made by malValuePtr::operator ->, which
+    // mustn't be reference counted.
+    if (!hasMeta() && malValuePtr::isImmediateInteger(m_value)) {
+        return mal::integer(m_value);
+    }
+    return malValuePtr(this);
+}
+
+malValuePtr malValue::eval(const malEnvPtr& env)
 {
     // Default case of eval is just to return the object itself.
     return malValuePtr(this);
@@ -357,51 +581,158 @@ malValuePtr malValue::eval(malEnvPtr env)
 bool malValue::isEqualTo(const malValue* rhs) const
 {
     // Special-case. Vectors and Lists can be compared.
-    bool matchingTypes = (typeid(*this) == typeid(*rhs)) ||
-        (dynamic_cast<const malSequence*>(this) &&
-         dynamic_cast<const malSequence*>(rhs));
+    bool matchingTypes = (type() == rhs->type()) ||
+        (malCast<malSequence>::isA(this) && malCast<malSequence>::isA(rhs));
 
     return matchingTypes && doIsEqualTo(rhs);
 }
 
+bool malValue::isEqualTo(const malValuePtr& rhs) const
+{
+    malValueArrow rhsObject(rhs);
+    return isEqualTo(rhsObject.get());
+}
+
 bool malValue::isTrue() const
 {
-    return (this != mal::falseValue().ptr())
-        && (this != mal::nilValue().ptr());
+    return (this != &mal::constants[0])     // nil
+        && (this != &mal::constants[2]);    // false
+}
+
+const size_t malValue::s_sizes[] = {
+    sizeof(malConstant), sizeof(malInteger), sizeof(malString),
+    sizeof(malKeyword), sizeof(malSymbol), sizeof(malListCell),
+    0, 0, sizeof(malBuiltIn), sizeof(malLambda), sizeof(malHash),
+    sizeof(malAtom),
+};
+
+typedef std::unordered_map<const malValue*, malValuePtr> MetaTable;
+
+// Never destroyed, as values may outlive any static destructor.
+static MetaTable& metaTable()
+{
+    static MetaTable* table = new MetaTable;
+    return *table;
 }
 
 malValuePtr malValue::meta() const
 {
-    return m_meta.ptr() == NULL ? mal::nilValue() : m_meta;
+    return m_hasMeta ? metaTable().find(this)->second : mal::nilValue();
 }
 
-malValuePtr malValue::withMeta(malValuePtr meta) const
+void malValue::setMeta(const malValuePtr& meta)
 {
-    return doWithMeta(meta);
+    if (meta && (meta != mal::nilValue())) {
+        metaTable()[this] = meta;
+        m_hasMeta = true;
+    }
 }
 
-malSequence::malSequence(malValueVec* items)
-: m_items(items)
+void malValue::clearMeta()
 {
+    // Releasing the metadata may destroy values with entries of their own,
+    // so take it out of the table first.
+    MetaTable& table = metaTable();
+    auto it = table.find(this);
+    malValuePtr meta = std::move(it->second);
+    table.erase(it);
+}
 
+// The expansions cached by macroExpand, along with the ids of the macros
+// which made them, so that a form headed by a name which is later bound to
+// another macro is expanded again. The macros themselves aren't held, as
+// the collector can't see this table, and a macro whose environment
+// reaches one of its call sites would never be freed.
+struct CachedExpansion {
+    unsigned macroId;
+    malValuePtr expansion;
+};
+typedef std::unordered_map<const malValue*, CachedExpansion> ExpansionTable;
+
+// Never destroyed, as values may outlive any static destructor.
+static ExpansionTable& expansionTable()
+{
+    static ExpansionTable* table = new ExpansionTable;
+    return *table;
 }
 
-malSequence::malSequence(malValueIter begin, malValueIter end)
-: m_items(new malValueVec(begin, end))
+malValuePtr malValue::cachedExpansion(unsigned macroId) const
 {
+    if (m_hasExpansion) {
+        const CachedExpansion& cached = expansionTable().find(this)->second;
+        if (cached.macroId == macroId) {
+            return cached.expansion;
+        }
+    }
+    return NULL;
+}
 
+// Whether the value is, or holds, a lambda or an atom, either of which
+// could reach the form being expanded through an environment. The
+// collector can't see the references held by the table, so such a cycle
+// would never be freed.
+static bool mayReachEnv(const malValuePtr& value)
+{
+    if (value->hasMeta() && mayReachEnv(value->meta())) {
+        return true;
+    }
+    if (DYNAMIC_CAST(malLambda, value) || DYNAMIC_CAST(malAtom, value)) {
+        return true;
+    }
+    if (const malSequence* seq = DYNAMIC_CAST(malSequence, value)) {
+        for (auto& item : *seq) {
+            if (mayReachEnv(item)) {
+                return true;
+            }
+        }
+    }
+    else if (const malHash* hash = DYNAMIC_CAST(malHash, value)) {
+        return mayReachEnv(hash->values()); // the keys are strings
+    }
+    return false;
+}
+
+void malValue::cacheExpansion(unsigned macroId,
+                              const malValuePtr& expansion) const
+{
+    if (mayReachEnv(expansion)) {
+        return;
+    }
+    CachedExpansion& cached = expansionTable()[this];
+    cached.macroId = macroId;
+    cached.expansion = expansion;
+    m_hasExpansion = true;
 }
 
-malSequence::malSequence(const malSequence& that, malValuePtr meta)
-: malValue(meta)
-, m_items(new malValueVec(*(that.m_items)))
+void malValue::clearExpansion()
 {
+    // As with the metadata, releasing the expansion may destroy values
+    // with entries of their own.
+    ExpansionTable& table = expansionTable();
+    auto it = table.find(this);
+    CachedExpansion cached = std::move(it->second);
+    table.erase(it);
+}
 
+malValuePtr malValue::withMeta(const malValuePtr& meta) const
+{
+    return doWithMeta(meta);
 }
 
-malSequence::~malSequence()
+malSequence::iterator malSequence::begin() const
 {
-    delete m_items;
+    iterator it;
+    nextRun(it, 0);
+    return it;
+}
+
+void malSequence::setRun(iterator& it, const malValuePtr* begin, int length,
+                         const malSequence* next, int nextIndex)
+{
+    it.m_ptr   = length > 0 ? begin : NULL;
+    it.m_end   = length > 0 ? begin + length : NULL;
+    it.m_seq   = next;
+    it.m_index = nextIndex;
 }
 
 bool malSequence::doIsEqualTo(const malValue* rhs) const
@@ -411,25 +742,28 @@ bool malSequence::doIsEqualTo(const malValue* rhs) const
         return false;
     }
 
-    for (malValueIter it0 = m_items->begin(),
-                      it1 = rhsSeq->begin(),
-                      end = m_items->end(); it0 != end; ++it0, ++it1) {
+    for (auto it0 = begin(), it1 = rhsSeq->begin(), end0 = end();
+         it0 != end0; ++it0, ++it1) {
 
-        if (! (*it0)->isEqualTo((*it1).ptr())) {
+        if (! (*it0)->isEqualTo(*it1)) {
             return false;
         }
     }
     return true;
 }
 
-malValueVec* malSequence::evalItems(malEnvPtr env) const
+malValueVec* malSequence::evalItems(const malEnvPtr& env) const
 {
-    malValueVec* items = new malValueVec;;
-    items->reserve(count());
-    for (auto it = m_items->begin(), end = m_items->end(); it != end; ++it) {
-        items->push_back(EVAL(*it, env));
+    std::unique_ptr<malValueVec> items(new malValueVec(count()));
+    evalItems(items->begin(), env);
+    return items.release();
+}
+
+void malSequence::evalItems(malValueIter out, const malEnvPtr& env) const
+{
+    for (auto it = begin(), end = this->end(); it != end; ++it, ++out) {
+        *out = EVAL(*it, env);
     }
-    return items;
 }
 
 malValuePtr malSequence::first() const
@@ -440,58 +774,287 @@ malValuePtr malSequence::first() const
 String malSequence::print(bool readably) const
 {
     String str;
-    auto end = m_items->cend();
-    auto it = m_items->cbegin();
+    auto end = this->end();
+    auto it = begin();
     if (it != end) {
-        str += (*it)->print(readably);
+        printTo(str, *it, readably);
         ++it;
     }
     for ( ; it != end; ++it) {
         str += " ";
-        str += (*it)->print(readably);
+        printTo(str, *it, readably);
     }
     return str;
 }
 
 malValuePtr malSequence::rest() const
 {
-    malValueIter start = (count() > 0) ? begin() + 1 : end();
-    return mal::list(start, end());
+    auto start = begin();
+    if (start != end()) {
+        ++start;
+    }
+    return mal::list(new malValueVec(start, end()));
 }
 
-String malString::escapedValue() const
+String malString::print(bool readably) const
 {
-    return escape(value());
+    String out;
+    appendTo(out, readably);
+    return out;
 }
 
-String malString::print(bool readably) const
+void malString::appendTo(String& out, bool readably) const
+{
+    if (readably) {
+        out += '"';
+    }
+    forEachRun([&out, readably](StringView run) {
+        if (readably) {
+            appendEscaped(out, run);
+        }
+        else {
+            out.append(run.data(), run.size());
+        }
+    });
+    if (readably) {
+        out += '"';
+    }
+}
+
+void malStringBase::flatten() const
+{
+    COUNT_REF(stringCopies);
+    const malRopePtr& rope = static_cast<const malString*>(this)->m_rope;
+    malStringBuffer* buffer = malStringBuffer::create(rope->length());
+    char* out = buffer->chars();
+    rope->forEachLeaf([&out](StringView chars) {
+        memcpy(out, chars.data(), chars.size());
+        out += chars.size();
+    });
+    m_buffer = buffer;
+}
+
+malStringBuffer* malStringBuffer::create(size_t length)
+{
+    void* memory = pool::allocateSized(sizeof(malStringBuffer) + length + 1);
+    malStringBuffer* buffer = new (memory) malStringBuffer(length);
+    buffer->chars()[length] = '\0';
+    return buffer;
+}
+
+malStringBuffer* malStringBuffer::create(StringView chars)
+{
+    COUNT_REF(stringCopies);
+    malStringBuffer* buffer = create(chars.size());
+    memcpy(buffer->chars(), chars.data(), chars.size());
+    return buffer;
+}
+
+malRope::malRope(const malStringBufferPtr& leaf)
+: m_leaf(leaf)
+, m_length(leaf->view().size())
+, m_height(0)
+{
+    memStats::created(memStats::KIND_ROPE, sizeof(malRope));
+}
+
+malRope::malRope(const malRopePtr& left, const malRopePtr& right)
+: m_left(left)
+, m_right(right)
+, m_length(left->m_length + right->m_length)
+, m_height(1 + std::max(left->m_height, right->m_height))
+{
+    memStats::created(memStats::KIND_ROPE, sizeof(malRope));
+}
+
+malRopePtr malRope::leaf(const malStringBufferPtr& buffer)
+{
+    return new malRope(buffer);
+}
+
+malRopePtr malRope::join(const malRopePtr& left, const malRopePtr& right)
+{
+    if (!left || (left->m_length == 0)) {
+        return right;
+    }
+    if (!right || (right->m_length == 0)) {
+        return left;
+    }
+
+    // Join the shorter rope to the facing side of the taller one, at the
+    // level where their heights match.
+    if (height(left) > height(right) + 1) {
+        return balance(left->m_left, join(left->m_right, right));
+    }
+    if (height(right) > height(left) + 1) {
+        return balance(join(left, right->m_left), right->m_right);
+    }
+    return node(left, right);
+}
+
+// Joins two ropes whose heights differ by up to two, rotating them to keep
+// the tree balanced.
+malRopePtr malRope::balance(const malRopePtr& left, const malRopePtr& right)
+{
+    if (height(left) > height(right) + 1) {
+        if (height(left->m_left) >= height(left->m_right)) {
+            return node(left->m_left, node(left->m_right, right));
+        }
+        const malRopePtr& middle = left->m_right;
+        return node(node(left->m_left, middle->m_left),
+                    node(middle->m_right, right));
+    }
+    if (height(right) > height(left) + 1) {
+        if (height(right->m_right) >= height(right->m_left)) {
+            return node(node(left, right->m_left), right->m_right);
+        }
+        const malRopePtr& middle = right->m_left;
+        return node(node(left, middle->m_left),
+                    node(middle->m_right, right->m_right));
+    }
+    return node(left, right);
+}
+
+// Joins two ropes of about the same height, merging them into one leaf if
+// they're both short leaves.
+malRopePtr malRope::node(const malRopePtr& left, const malRopePtr& right)
+{
+    size_t length = left->m_length + right->m_length;
+    if (left->m_leaf && right->m_leaf && (length <= MAX_MERGED_LEAF)) {
+        COUNT_REF(stringCopies);
+        malStringBuffer* buffer = malStringBuffer::create(length);
+        memcpy(buffer->chars(), left->m_leaf->chars(), left->m_length);
+        memcpy(buffer->chars() + left->m_length,
+               right->m_leaf->chars(), right->m_length);
+        return leaf(buffer);
+    }
+    return new malRope(left, right);
+}
+
+void printTo(String& out, const malValuePtr& value, bool readably)
+{
+    if (const malString* str = DYNAMIC_CAST(malString, value)) {
+        str->appendTo(out, readably);
+    }
+    else if (const malStringBase* str = DYNAMIC_CAST(malStringBase, value)) {
+        StringView chars = str->value();
+        out.append(chars.data(), chars.size());
+    }
+    else {
+        out += value->print(readably);
+    }
+}
+
+malValuePtr malSymbol::eval(const malEnvPtr& env)
+{
+    return env->get(this);
+}
+
+malVector* malVector::create(const Trie& trie,
+                             const malValuePtr* tail, int tailCount,
+                             const malValuePtr& meta)
+{
+    void* memory = pool::allocateSized(sizeof(malVector)
+                                       + tailCount * sizeof(malValuePtr));
+    return new (memory) malVector(trie, tail, tailCount, meta);
+}
+
+malVector::malVector(const Trie& trie, const malValuePtr* tail, int tailCount,
+                     const malValuePtr& meta)
+: malSequence(TYPE_VECTOR, trie.size() + tailCount)
+, m_trie(trie)
+, m_tailCount(tailCount)
+{
+    countTrailingStorage();
+    setMeta(meta);
+    std::uninitialized_copy(tail, tail + tailCount, this->tail());
+}
+
+malVector::~malVector()
 {
-    return readably ? escapedValue() : value();
+    for (int i = 0; i < m_tailCount; i++) {
+        tail()[i].~malValuePtr();
+    }
 }
 
-malValuePtr malSymbol::eval(malEnvPtr env)
+// Appends value to the vector held in trie and tail, moving the tail into
+// the trie first if it's full.
+static void pushItem(malVector::Trie& trie, malValuePtr* tail, int& tailCount,
+                     const malValuePtr& value)
 {
-    return env->get(value());
+    if (tailCount == malVector::Trie::LEAF_SIZE) {
+        trie = trie.pushLeaf(tail);
+        tailCount = 0;
+    }
+    tail[tailCount++] = value;
+}
+
+malValuePtr malVector::assoc(malValueIter argsBegin,
+                             malValueIter argsEnd) const
+{
+    MAL_CHECK(std::distance(argsBegin, argsEnd) % 2 == 0,
+            "assoc requires an even-sized list");
+
+    Trie trie(m_trie);
+    malValuePtr tail[Trie::LEAF_SIZE];
+    int tailCount = m_tailCount;
+    std::copy(this->tail(), this->tail() + m_tailCount, tail);
+    for (auto it = argsBegin; it != argsEnd; ++it) {
+        // Checked before narrowing, so that large indices can't wrap.
+        int64_t value = VALUE_CAST(malInteger, *it++)->value();
+        int size = trie.size() + tailCount;
+        MAL_CHECK(value >= 0 && value <= size, "Index out of range");
+        int index = static_cast<int>(value);
+        if (index == size) {
+            pushItem(trie, tail, tailCount, *it);
+        }
+        else if (index >= trie.size()) {
+            tail[index - trie.size()] = *it;
+        }
+        else {
+            trie = trie.set(index, *it);
+        }
+    }
+    return create(trie, tail, tailCount);
 }
 
 malValuePtr malVector::conj(malValueIter argsBegin,
                             malValueIter argsEnd) const
 {
-    int oldItemCount = std::distance(begin(), end());
-    int newItemCount = std::distance(argsBegin, argsEnd);
-
-    malValueVec* items = new malValueVec(oldItemCount + newItemCount);
-    std::copy(begin(), end(), items->begin());
-    std::copy(argsBegin, argsEnd, items->begin() + oldItemCount);
+    Trie trie(m_trie);
+    malValuePtr tail[Trie::LEAF_SIZE];
+    int tailCount = m_tailCount;
+    std::copy(this->tail(), this->tail() + m_tailCount, tail);
+    for (auto it = argsBegin; it != argsEnd; ++it) {
+        pushItem(trie, tail, tailCount, *it);
+    }
+    return create(trie, tail, tailCount);
+}
 
-    return mal::vector(items);
+malValuePtr malVector::doWithMeta(const malValuePtr& meta) const
+{
+    return create(m_trie, tail(), m_tailCount, meta);
 }
 
-malValuePtr malVector::eval(malEnvPtr env)
+malValuePtr malVector::eval(const malEnvPtr& env)
 {
     return mal::vector(evalItems(env));
 }
 
+void malVector::nextRun(iterator& it, int index) const
+{
+    int length = 0;
+    const malValuePtr* run = NULL;
+    if (index < m_trie.size()) {
+        run = m_trie.run(index, length);
+    }
+    else if (index < count()) {
+        run = tail() + (index - m_trie.size());
+        length = count() - index;
+    }
+    setRun(it, run, length, this, index + length);
+}
+
 String malVector::print(bool readably) const
 {
     return '[' + malSequence::print(readably) + ']';
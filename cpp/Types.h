@@ -1,65 +1,172 @@
 #ifndef INCLUDE_TYPES_H
 #define INCLUDE_TYPES_H
 
+#include "Collector.h"
+#include "HashTrie.h"
 #include "MAL.h"
+#include "MemStats.h"
+#include "Pool.h"
+#include "VectorTrie.h"
 
 #include <exception>
-#include <map>
+#include <iterator>
+#include <new>
+#include <utility>
 
 class malEmptyInputException : public std::exception { };
 
+// Every value carries a type, which the casts below check in place of
+// dynamic_cast. The types are listed in a depth-first walk of the class
+// hierarchy, so each abstract class covers a contiguous range of them,
+// declared with TYPE_RANGE.
+//
+// Few values ever have metadata, so rather than each carrying a slot for
+// it, it's held in a table keyed by the value's address, and the value
+// just flags that it has an entry there.
 class malValue : public RefCounted {
 public:
-    malValue() {
+    enum Type {
+        TYPE_CONSTANT,
+        TYPE_INTEGER,
+        TYPE_STRING,        // malStringBase
+        TYPE_KEYWORD,
+        TYPE_SYMBOL,
+        TYPE_LIST_CELL,     // malSequence, malList
+        TYPE_LIST_VIEW,
+        TYPE_VECTOR,
+        TYPE_BUILTIN,       // malApplicable
+        TYPE_LAMBDA,
+        TYPE_HASH,
+        TYPE_ATOM,
+    };
+    enum { FIRST_TYPE = TYPE_CONSTANT, LAST_TYPE = TYPE_ATOM };
+    static_assert(LAST_TYPE + 1 == memStats::VALUE_KINDS,
+                  "memStats needs a kind for each type");
+
+    // For the temporaries made by malValueArrow, which live on the stack
+    // and aren't counted by memStats.
+    struct Temporary { };
+
+    malValue(Type type)
+        : m_type(type), m_hasMeta(false), m_hasExpansion(false)
+        , m_counted(true) {
         TRACE_OBJECT("Creating malValue %p\n", this);
+        countFixedSize();
     }
-    malValue(malValuePtr meta) : m_meta(meta) {
+    malValue(Type type, const malValuePtr& meta)
+        : m_type(type), m_hasMeta(false), m_hasExpansion(false)
+        , m_counted(true) {
         TRACE_OBJECT("Creating malValue %p\n", this);
+        countFixedSize();
+        setMeta(meta);
     }
+    malValue(Type type, Temporary)
+        : m_type(type), m_hasMeta(false), m_hasExpansion(false)
+        , m_counted(false) { }
     virtual ~malValue() {
         TRACE_OBJECT("Destroying malValue %p\n", this);
+        if (m_hasMeta) {
+            clearMeta();
+        }
+        if (m_hasExpansion) {
+            clearExpansion();
+        }
+        if (m_counted) {
+            memStats::destroyed(m_type, footprint());
+        }
     }
 
-    malValuePtr withMeta(malValuePtr meta) const;
-    virtual malValuePtr doWithMeta(malValuePtr meta) const = 0;
+    static void* operator new(size_t size) { return pool::allocate(size); }
+    static void* operator new(size_t size, void* memory) { return memory; }
+    static void operator delete(void* memory, size_t size) {
+        pool::deallocate(memory, size);
+    }
+
+    Type type() const { return static_cast<Type>(m_type); }
+
+    malValuePtr withMeta(const malValuePtr& meta) const;
+    virtual malValuePtr doWithMeta(const malValuePtr& meta) const = 0;
     malValuePtr meta() const;
+    bool hasMeta() const { return m_hasMeta; }
+
+    // The expansion of this form by the macro with the given macroId(), if
+    // macroExpand has cached one, or NULL. Like metadata, it is kept in a
+    // side table. Expansions holding lambdas or atoms aren't cached.
+    malValuePtr cachedExpansion(unsigned macroId) const;
+    void cacheExpansion(unsigned macroId, const malValuePtr& expansion) const;
 
     bool isTrue() const;
 
     bool isEqualTo(const malValue* rhs) const;
+    bool isEqualTo(const malValuePtr& rhs) const;
 
-    virtual malValuePtr eval(malEnvPtr env);
+    virtual malValuePtr eval(const malEnvPtr& env);
 
     virtual String print(bool readably) const = 0;
 
 protected:
     virtual bool doIsEqualTo(const malValue* rhs) const = 0;
 
-    malValuePtr m_meta;
-};
+    // Only for use while constructing the value.
+    void setMeta(const malValuePtr& meta);
 
-template<class T>
-T* value_cast(malValuePtr obj, const char* typeName) {
-    T* dest = dynamic_cast<T*>(obj.ptr());
-    MAL_CHECK(dest != NULL, "%s is not a %s",
-              obj->print(true).c_str(), typeName);
-    return dest;
-}
+    // List views and vectors are allocated along with their items, so
+    // they count themselves once constructed, with their sizes taken from
+    // the pool.
+    void countTrailingStorage() {
+        memStats::created(m_type, pool::sizedAllocation(this));
+    }
 
-#define VALUE_CAST(Type, Value)    value_cast<Type>(Value, #Type)
-#define DYNAMIC_CAST(Type, Value)  (dynamic_cast<Type*>((Value).ptr()))
-#define STATIC_CAST(Type, Value)   (static_cast<Type*>((Value).ptr()))
+private:
+    void clearMeta();
+    void clearExpansion();
+
+    void countFixedSize() {
+        if (size_t size = s_sizes[m_type]) {
+            memStats::created(m_type, size);
+        }
+    }
+
+    size_t footprint() const {
+        size_t size = s_sizes[m_type];
+        return size ? size : pool::sizedAllocation(this);
+    }
+
+    static const size_t s_sizes[];  // of each type, or 0 if it varies
+
+    const unsigned char m_type;
+    bool m_hasMeta;
+    mutable bool m_hasExpansion;
+    const bool m_counted;
+};
+
+#define TYPE_RANGE(First, Last) \
+    enum { FIRST_TYPE = First, LAST_TYPE = Last } \
 
 #define WITH_META(Type) \
-    virtual malValuePtr doWithMeta(malValuePtr meta) const { \
+    virtual malValuePtr doWithMeta(const malValuePtr& meta) const { \
         return new Type(*this, meta); \
     } \
 
+// For classes which allocate items after the object itself, in create.
+#define TRAILING_STORAGE \
+    static void* operator new(size_t size) { \
+        return pool::allocateSized(size); \
+    } \
+    static void* operator new(size_t size, void* memory) { return memory; } \
+    static void operator delete(void* memory) { \
+        pool::deallocateSized(memory); \
+    } \
+
 class malConstant : public malValue {
 public:
-    malConstant(String name) : m_name(name) { }
-    malConstant(const malConstant& that, malValuePtr meta)
-        : malValue(meta), m_name(that.m_name) { }
+    TYPE_RANGE(TYPE_CONSTANT, TYPE_CONSTANT);
+
+    malConstant(String name) : malValue(TYPE_CONSTANT), m_name(name) { }
+    malConstant(const malConstant& that, const malValuePtr& meta)
+        : malValue(TYPE_CONSTANT, meta), m_name(that.m_name) { }
+
+    virtual malValuePtr eval(const malEnvPtr& env);
 
     virtual String print(bool readably) const { return m_name; }
 
@@ -73,11 +180,20 @@ private:
     const String m_name;
 };
 
+// Most integers are unboxed (see ValuePtr.h). A malInteger object is only
+// allocated for values with metadata or outside the immediate range, and
+// is otherwise constructed on the fly by malValuePtr::operator ->.
 class malInteger : public malValue {
 public:
-    malInteger(int64_t value) : m_value(value) { }
-    malInteger(const malInteger& that, malValuePtr meta)
-        : malValue(meta), m_value(that.m_value) { }
+    TYPE_RANGE(TYPE_INTEGER, TYPE_INTEGER);
+
+    malInteger(int64_t value) : malValue(TYPE_INTEGER), m_value(value) { }
+    malInteger(int64_t value, Temporary temporary)
+        : malValue(TYPE_INTEGER, temporary), m_value(value) { }
+    malInteger(const malInteger& that, const malValuePtr& meta)
+        : malValue(TYPE_INTEGER, meta), m_value(that.m_value) { }
+
+    virtual malValuePtr eval(const malEnvPtr& env);
 
     virtual String print(bool readably) const {
         return std::to_string(m_value);
@@ -95,85 +211,442 @@ private:
     const int64_t m_value;
 };
 
+// The result of malValuePtr::operator ->. For an unboxed integer this
+// holds a temporary malInteger, which lives until the end of the full
+// expression containing the ->, so that virtual calls work on any value.
+class malValueArrow {
+public:
+    malValueArrow(const malValuePtr& value) {
+        if (value.isInteger()) {
+            m_object = new (m_storage) malInteger(value.integerValue(),
+                                                  malValue::Temporary());
+        }
+        else {
+            m_object = value.ptr();
+        }
+    }
+
+    malValueArrow(const malValueArrow& that) {
+        if (that.isTemporary()) {
+            m_object = new (m_storage) malInteger(
+                static_cast<const malInteger*>(that.m_object)->value(),
+                malValue::Temporary());
+        }
+        else {
+            m_object = that.m_object;
+        }
+    }
+
+    ~malValueArrow() {
+        if (isTemporary()) {
+            static_cast<malInteger*>(m_object)->~malInteger();
+        }
+    }
+
+    malValue* operator -> () const { return m_object; }
+    malValue* get() const { return m_object; }
+
+private:
+    malValueArrow& operator = (const malValueArrow&); // no assignments
+
+    bool isTemporary() const {
+        return m_object == reinterpret_cast<const malValue*>(m_storage);
+    }
+
+    malValue* m_object;
+    alignas(malInteger) char m_storage[sizeof(malInteger)];
+};
+
+// The casts go through malCast so that types which may be unboxed (see
+// ValuePtr.h) can return something other than a raw pointer. They check
+// the type against T's TYPE_RANGE rather than using RTTI.
+template<class T>
+struct malCast {
+    typedef T* Ptr;
+
+    static bool isA(const malValue* object) {
+        return static_cast<unsigned>(object->type() - T::FIRST_TYPE)
+            <= static_cast<unsigned>(T::LAST_TYPE - T::FIRST_TYPE);
+    }
+
+    static Ptr dynamicCast(const malValuePtr& obj) {
+        malValue* object = obj.ptr();
+        return (object && isA(object)) ? static_cast<T*>(object) : NULL;
+    }
+
+    static Ptr staticCast(const malValuePtr& obj) {
+        return static_cast<T*>(obj.ptr());
+    }
+};
+
+template<class T>
+typename malCast<T>::Ptr value_cast(const malValuePtr& obj,
+                                    const char* typeName) {
+    typename malCast<T>::Ptr dest = malCast<T>::dynamicCast(obj);
+    MAL_CHECK(dest, "%s is not a %s", obj->print(true).c_str(), typeName);
+    return dest;
+}
+
+#define VALUE_CAST(Type, Value)    value_cast<Type>(Value, #Type)
+#define DYNAMIC_CAST(Type, Value)  (malCast<Type>::dynamicCast(Value))
+#define STATIC_CAST(Type, Value)   (malCast<Type>::staticCast(Value))
+
+// The result of casting to malInteger. There is usually no object to
+// point at, so this holds the value and mimics the pointer it replaces.
+class malIntegerRef {
+public:
+    malIntegerRef() : m_isValid(false), m_value(0) { }
+    malIntegerRef(int64_t value) : m_isValid(true), m_value(value) { }
+
+    explicit operator bool () const { return m_isValid; }
+    const malIntegerRef* operator -> () const { return this; }
+
+    int64_t value() const { return m_value; }
+
+private:
+    bool    m_isValid;
+    int64_t m_value;
+};
+
+template<>
+struct malCast<malInteger> {
+    typedef malIntegerRef Ptr;
+
+    static Ptr dynamicCast(const malValuePtr& obj) {
+        if (obj.isInteger()) {
+            return malIntegerRef(obj.integerValue());
+        }
+        const malValue* object = obj.ptr();
+        return (object && (object->type() == malValue::TYPE_INTEGER))
+            ? malIntegerRef(static_cast<const malInteger*>(object)->value())
+            : malIntegerRef();
+    }
+
+    static Ptr staticCast(const malValuePtr& obj) {
+        return obj.isInteger()
+            ? malIntegerRef(obj.integerValue())
+            : malIntegerRef(static_cast<malInteger*>(obj.ptr())->value());
+    }
+};
+
+// The characters of a string, keyword or symbol, allocated along with the
+// buffer and never changed, so that copies made by with-meta can share
+// them. They're followed by a NUL, for the C library.
+class malStringBuffer : public RefCounted {
+public:
+    static malStringBuffer* create(StringView chars);
+    static malStringBuffer* create(size_t length); // to be filled in
+    ~malStringBuffer() {
+        memStats::destroyed(memStats::KIND_STRING_BUFFER,
+                            sizeof(malStringBuffer) + m_length + 1);
+    }
+
+    TRAILING_STORAGE;
+
+    const char* chars() const {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+    char* chars() { return reinterpret_cast<char*>(this + 1); }
+
+    StringView view() const { return StringView(chars(), m_length); }
+
+    // Computed on first use, as most strings are never used as keys.
+    size_t hash() const {
+        if (m_hash == 0) {
+            m_hash = StringViewHash()(view());
+        }
+        return m_hash;
+    }
+
+private:
+    malStringBuffer(size_t length) : m_length(length), m_hash(0) {
+        memStats::created(memStats::KIND_STRING_BUFFER,
+                          sizeof(malStringBuffer) + m_length + 1);
+    }
+
+    const size_t m_length;
+    mutable size_t m_hash;
+};
+
+typedef RefCountedPtr<malStringBuffer> malStringBufferPtr;
+
+class malRope;
+typedef RefCountedPtr<malRope> malRopePtr;
+
+// A string built up by concatenation, as a balanced tree whose leaves are
+// flat buffers. Joining two ropes shares both of them, and takes time in
+// proportion to the difference in their heights. Short leaves are merged,
+// so that a rope built a character at a time doesn't need a node for each
+// one.
+class malRope : public RefCounted {
+public:
+    enum { MAX_MERGED_LEAF = 256 };
+
+    static malRopePtr leaf(const malStringBufferPtr& buffer);
+    static malRopePtr join(const malRopePtr& left, const malRopePtr& right);
+
+    static void* operator new(size_t size) { return pool::allocate(size); }
+    static void operator delete(void* memory, size_t size) {
+        pool::deallocate(memory, size);
+    }
+
+    ~malRope() {
+        memStats::destroyed(memStats::KIND_ROPE, sizeof(malRope));
+    }
+
+    size_t length() const { return m_length; }
+
+    // Calls visit with the characters of each leaf, in order.
+    template<class Visit>
+    void forEachLeaf(Visit visit) const {
+        if (m_leaf) {
+            visit(m_leaf->view());
+        }
+        else {
+            m_left->forEachLeaf(visit);
+            m_right->forEachLeaf(visit);
+        }
+    }
+
+private:
+    malRope(const malStringBufferPtr& leaf);
+    malRope(const malRopePtr& left, const malRopePtr& right);
+
+    static malRopePtr node(const malRopePtr& left, const malRopePtr& right);
+    static malRopePtr balance(const malRopePtr& left,
+                              const malRopePtr& right);
+    static int height(const malRopePtr& rope) {
+        return rope ? rope->m_height : -1;
+    }
+
+    const malStringBufferPtr m_leaf;    // NULL for a node
+    const malRopePtr m_left;
+    const malRopePtr m_right;
+    const size_t m_length;
+    const int m_height;                 // 0 for a leaf
+};
+
 class malStringBase : public malValue {
 public:
-    malStringBase(const String& token)
-        : m_value(token) { }
-    malStringBase(const malStringBase& that, malValuePtr meta)
-        : malValue(meta), m_value(that.value()) { }
+    TYPE_RANGE(TYPE_STRING, TYPE_SYMBOL);
+
+    malStringBase(Type type, StringView token)
+        : malValue(type), m_buffer(malStringBuffer::create(token)) { }
+    malStringBase(const malStringBase& that, const malValuePtr& meta)
+        : malValue(that.type(), meta), m_buffer(that.m_buffer) { }
 
-    virtual String print(bool readably) const { return m_value; }
+    virtual String print(bool readably) const { return value().str(); }
 
-    String value() const { return m_value; }
+    // Strings which are ropes are flattened on first use of these.
+    StringView value() const { return buffer()->view(); }
+    const char* c_str() const { return buffer()->chars(); }
+    size_t hash() const { return buffer()->hash(); }
+
+    bool hasSameValue(const malStringBase* that) const {
+        return (m_buffer && (m_buffer == that->m_buffer))
+            || (value() == that->value());
+    }
+
+protected:
+    // For a rope, which supplies the buffer when it's first needed.
+    malStringBase(Type type) : malValue(type) { }
+
+    const malStringBufferPtr& buffer() const {
+        if (!m_buffer) {
+            flatten();
+        }
+        return m_buffer;
+    }
 
 private:
-    const String m_value;
+    void flatten() const;
+
+    mutable malStringBufferPtr m_buffer;
 };
 
 class malString : public malStringBase {
 public:
-    malString(const String& token)
-        : malStringBase(token) { }
-    malString(const malString& that, malValuePtr meta)
-        : malStringBase(that, meta) { }
+    TYPE_RANGE(TYPE_STRING, TYPE_STRING);
+
+    malString(StringView token)
+        : malStringBase(TYPE_STRING, token) { }
+    malString(const malRopePtr& rope)
+        : malStringBase(TYPE_STRING), m_rope(rope) { }
+    malString(const malString& that, const malValuePtr& meta)
+        : malStringBase(that, meta), m_rope(that.m_rope) { }
 
     virtual String print(bool readably) const;
 
-    String escapedValue() const;
+    // Appends print(readably) to out.
+    void appendTo(String& out, bool readably) const;
+
+    size_t length() const {
+        return m_rope ? m_rope->length() : value().size();
+    }
+
+    // The string as a rope, whether or not it was built as one.
+    malRopePtr rope() const {
+        return m_rope ? m_rope : malRope::leaf(buffer());
+    }
+
+    // Calls visit with each run of the string's characters, in order,
+    // without flattening a rope.
+    template<class Visit>
+    void forEachRun(Visit visit) const {
+        if (m_rope) {
+            m_rope->forEachLeaf(visit);
+        }
+        else {
+            visit(value());
+        }
+    }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return value() == static_cast<const malString*>(rhs)->value();
+        return hasSameValue(static_cast<const malString*>(rhs));
     }
 
     WITH_META(malString);
+
+private:
+    friend class malStringBase;
+
+    const malRopePtr m_rope;    // NULL unless built as one
 };
 
+// Keywords are interned by mal::keyword(), in the same way as symbols.
 class malKeyword : public malStringBase {
 public:
-    malKeyword(const String& token)
-        : malStringBase(token) { }
-    malKeyword(const malKeyword& that, malValuePtr meta)
+    TYPE_RANGE(TYPE_KEYWORD, TYPE_KEYWORD);
+
+    malKeyword(StringView token)
+        : malStringBase(TYPE_KEYWORD, token) { }
+    malKeyword(const malKeyword& that, const malValuePtr& meta)
         : malStringBase(that, meta) { }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return value() == static_cast<const malKeyword*>(rhs)->value();
+        return this == rhs
+            || hasSameValue(static_cast<const malKeyword*>(rhs));
     }
 
     WITH_META(malKeyword);
 };
 
+// Symbols are interned by mal::symbol(), so there is one malSymbol per
+// name, plus any copies made by with-meta, which keep the same id. The id
+// identifies the symbol in environments and doubles as its hash.
+// The symbols of the special forms are interned before any others, so that
+// they have these ids, and EVAL can switch on the id of a list's head.
+enum SpecialForm {
+    SPECIAL_CATCH,
+    SPECIAL_DEF,
+    SPECIAL_DEFMACRO,
+    SPECIAL_DO,
+    SPECIAL_FN,
+    SPECIAL_IF,
+    SPECIAL_LET,
+    SPECIAL_MACROEXPAND,
+    SPECIAL_QUASIQUOTE,
+    SPECIAL_QUOTE,
+    SPECIAL_TRY,
+    SPECIAL_FORMS,      // the first id of an ordinary symbol
+};
+
 class malSymbol : public malStringBase {
 public:
-    malSymbol(const String& token)
-        : malStringBase(token) { }
-    malSymbol(const malSymbol& that, malValuePtr meta)
-        : malStringBase(that, meta) { }
+    TYPE_RANGE(TYPE_SYMBOL, TYPE_SYMBOL);
+
+    malSymbol(StringView token, int id)
+        : malStringBase(TYPE_SYMBOL, token), m_id(id)
+        , m_global(NULL), m_globalVersion(0) { }
+    malSymbol(const malSymbol& that, const malValuePtr& meta)
+        : malStringBase(that, meta), m_id(that.m_id)
+        , m_global(NULL), m_globalVersion(0) { }
 
-    virtual malValuePtr eval(malEnvPtr env);
+    virtual malValuePtr eval(const malEnvPtr& env);
+
+    int id() const { return m_id; }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
-        return value() == static_cast<const malSymbol*>(rhs)->value();
+        return m_id == static_cast<const malSymbol*>(rhs)->m_id;
     }
 
     WITH_META(malSymbol);
+
+private:
+    friend class malEnv;
+
+    const int m_id;
+
+    // Where malEnv last found this symbol's global binding, valid while
+    // m_globalVersion matches its version.
+    mutable const malValuePtr* m_global;
+    mutable unsigned m_globalVersion;
 };
 
+// Sequences are iterated one contiguous run of elements at a time, so the
+// iterator only needs to ask the sequence where the next run is when it
+// reaches the end of the current one.
 class malSequence : public malValue {
 public:
-    malSequence(malValueVec* items);
-    malSequence(malValueIter begin, malValueIter end);
-    malSequence(const malSequence& that, malValuePtr meta);
-    virtual ~malSequence();
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef malValuePtr                 value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef const malValuePtr*          pointer;
+        typedef const malValuePtr&          reference;
+
+        iterator() : m_ptr(NULL), m_end(NULL), m_seq(NULL), m_index(0) { }
+
+        reference operator * () const { return *m_ptr; }
+        pointer operator -> () const { return m_ptr; }
+
+        iterator& operator ++ () {
+            if (++m_ptr == m_end) {
+                m_seq->nextRun(*this, m_index);
+            }
+            return *this;
+        }
+
+        iterator operator ++ (int) {
+            iterator it(*this);
+            ++*this;
+            return it;
+        }
+
+        bool operator == (const iterator& that) const {
+            return m_ptr == that.m_ptr;
+        }
+
+        bool operator != (const iterator& that) const {
+            return m_ptr != that.m_ptr;
+        }
+
+    private:
+        friend class malSequence;
+
+        const malValuePtr* m_ptr;
+        const malValuePtr* m_end;
+        const malSequence* m_seq;   // supplies the run after this one
+        int m_index;                // where that run starts in m_seq
+    };
+
+    TYPE_RANGE(TYPE_LIST_CELL, TYPE_VECTOR);
+
+    malSequence(Type type, int count) : malValue(type), m_count(count) { }
+    malSequence(const malSequence& that, const malValuePtr& meta)
+        : malValue(that.type(), meta), m_count(that.m_count) { }
 
     virtual String print(bool readably) const;
 
-    malValueVec* evalItems(malEnvPtr env) const;
-    int count() const { return m_items->size(); }
-    bool isEmpty() const { return m_items->empty(); }
-    malValuePtr item(int index) const { return (*m_items)[index]; }
+    malValueVec* evalItems(const malEnvPtr& env) const;
+    void evalItems(malValueIter out, const malEnvPtr& env) const;
+    int count() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+    virtual const malValuePtr& item(int index) const = 0;
 
-    malValueIter begin() const { return m_items->begin(); }
-    malValueIter end()   const { return m_items->end(); }
+    iterator begin() const;
+    iterator end()   const { return iterator(); }
 
     virtual bool doIsEqualTo(const malValue* rhs) const;
 
@@ -183,67 +656,197 @@ public:
     malValuePtr first() const;
     virtual malValuePtr rest() const;
 
+protected:
+    // Points it at the run of elements starting at index, or at the end
+    // if there are no more.
+    virtual void nextRun(iterator& it, int index) const = 0;
+
+    static void setRun(iterator& it, const malValuePtr* begin, int length,
+                       const malSequence* next, int nextIndex);
+
 private:
-    malValueVec* const m_items;
+    const int m_count;
 };
 
+// Lists are immutable, and come in two forms which can be mixed freely:
+// cons cells, which hold one item and share the rest of the list, and views
+// onto a suffix of an array of items. Neither cons nor rest copies any items.
 class malList : public malSequence {
 public:
-    malList(malValueVec* items) : malSequence(items) { }
-    malList(malValueIter begin, malValueIter end)
-        : malSequence(begin, end) { }
-    malList(const malList& that, malValuePtr meta)
+    TYPE_RANGE(TYPE_LIST_CELL, TYPE_LIST_VIEW);
+
+    malList(Type type, int count) : malSequence(type, count) { }
+    malList(const malList& that, const malValuePtr& meta)
         : malSequence(that, meta) { }
 
     virtual String print(bool readably) const;
-    virtual malValuePtr eval(malEnvPtr env);
+    virtual malValuePtr eval(const malEnvPtr& env);
 
     virtual malValuePtr conj(malValueIter argsBegin,
                              malValueIter argsEnd) const;
+};
+
+// Each cell caches the count of the list which starts there. The empty
+// list is a cell with no item, and mal::list() returns a shared one.
+class malListCell : public malList {
+public:
+    TYPE_RANGE(TYPE_LIST_CELL, TYPE_LIST_CELL);
+
+    malListCell() : malList(TYPE_LIST_CELL, 0) { }
+    malListCell(const malValuePtr& first, const malValuePtr& rest);
+    malListCell(const malListCell& that, const malValuePtr& meta)
+        : malList(that, meta), m_first(that.m_first), m_rest(that.m_rest) { }
+    virtual ~malListCell();
+
+    virtual const malValuePtr& item(int index) const;
+    virtual malValuePtr rest() const;
+
+    WITH_META(malListCell);
+
+protected:
+    virtual void nextRun(iterator& it, int index) const;
+
+private:
+    const malValuePtr m_first;
+    malValuePtr m_rest;     // a malList, or NULL at the end of the list
+};
+
+// A list view either owns its items, which are allocated along with it, or
+// refers to a suffix of the items owned by another view. The views made by
+// rest and with-meta share the owner's items rather than copying them.
+class malListView : public malList {
+public:
+    TYPE_RANGE(TYPE_LIST_VIEW, TYPE_LIST_VIEW);
+
+    static malListView* create(const malValuePtr* items, int count);
+    malListView(const malListView& that, const malValuePtr& meta)
+        : malList(that, meta), m_owner(that.owner()), m_items(that.m_items) {
+        countTrailingStorage();
+    }
+    virtual ~malListView();
+
+    TRAILING_STORAGE;
+
+    virtual const malValuePtr& item(int index) const {
+        return m_items[index];
+    }
+    virtual malValuePtr rest() const;
+
+    WITH_META(malListView);
+
+protected:
+    virtual void nextRun(iterator& it, int index) const;
+
+private:
+    malListView(const malValuePtr& owner, const malValuePtr* items, int count)
+        : malList(TYPE_LIST_VIEW, count), m_owner(owner), m_items(items) {
+        countTrailingStorage();
+    }
 
-    WITH_META(malList);
+    malValuePtr owner() const;
+
+    const malValuePtr m_owner;  // NULL if this view owns the items
+    const malValuePtr* const m_items;
 };
 
+// Vectors are persistent, so conj and assoc share all but a few nodes with
+// the original vector. The last 1-32 items are held in a tail allocated
+// along with the vector, and the rest in a VectorTrie.
 class malVector : public malSequence {
 public:
-    malVector(malValueVec* items) : malSequence(items) { }
-    malVector(malValueIter begin, malValueIter end)
-        : malSequence(begin, end) { }
-    malVector(const malVector& that, malValuePtr meta)
-        : malSequence(that, meta) { }
+    TYPE_RANGE(TYPE_VECTOR, TYPE_VECTOR);
+
+    typedef VectorTrie<malValuePtr> Trie;
+
+    static malVector* create(const Trie& trie,
+                             const malValuePtr* tail, int tailCount,
+                             const malValuePtr& meta = NULL);
+    virtual ~malVector();
 
-    virtual malValuePtr eval(malEnvPtr env);
+    TRAILING_STORAGE;
+
+    virtual malValuePtr eval(const malEnvPtr& env);
     virtual String print(bool readably) const;
 
+    virtual const malValuePtr& item(int index) const {
+        return index < m_trie.size() ? m_trie[index]
+                                     : tail()[index - m_trie.size()];
+    }
+
+    malValuePtr assoc(malValueIter argsBegin, malValueIter argsEnd) const;
     virtual malValuePtr conj(malValueIter argsBegin,
                              malValueIter argsEnd) const;
 
-    WITH_META(malVector);
+    virtual malValuePtr doWithMeta(const malValuePtr& meta) const;
+
+protected:
+    virtual void nextRun(iterator& it, int index) const;
+
+private:
+    malVector(const Trie& trie, const malValuePtr* tail, int tailCount,
+              const malValuePtr& meta);
+
+    malValuePtr* tail() const {
+        return reinterpret_cast<malValuePtr*>(const_cast<malVector*>(this) + 1);
+    }
+
+    const Trie m_trie;
+    const int m_tailCount;
 };
 
 class malApplicable : public malValue {
 public:
-    malApplicable() { }
-    malApplicable(malValuePtr meta) : malValue(meta) { }
+    TYPE_RANGE(TYPE_BUILTIN, TYPE_LAMBDA);
+
+    malApplicable(Type type) : malValue(type) { }
+    malApplicable(Type type, const malValuePtr& meta)
+        : malValue(type, meta) { }
 
     virtual malValuePtr apply(malValueIter argsBegin,
                                malValueIter argsEnd) const = 0;
 };
 
+// Hash maps are keyed by the malString and malKeyword objects themselves.
+// Keywords are interned, so most key comparisons are a pointer compare.
+// The map is a persistent HashTrie, so assoc and dissoc share structure
+// with the original rather than copying it.
 class malHash : public malValue {
 public:
-    typedef std::map<String, malValuePtr> Map;
+    struct KeyHash {
+        size_t operator () (const malValuePtr& key) const {
+            return STATIC_CAST(malStringBase, key)->hash();
+        }
+    };
+
+    struct KeyEqual {
+        bool operator () (const malValuePtr& lhs,
+                          const malValuePtr& rhs) const {
+            if (lhs == rhs) {
+                return true;
+            }
+            const malStringBase* l = STATIC_CAST(malStringBase, lhs);
+            const malStringBase* r = STATIC_CAST(malStringBase, rhs);
+            return (l->hash() == r->hash())
+                && (l->type() == r->type())
+                && l->hasSameValue(r);
+        }
+    };
+
+    typedef HashTrie<malValuePtr, malValuePtr, KeyHash, KeyEqual> Map;
+
+    TYPE_RANGE(TYPE_HASH, TYPE_HASH);
 
     malHash(malValueIter argsBegin, malValueIter argsEnd, bool isEvaluated);
     malHash(const malHash::Map& map);
-    malHash(const malHash& that, malValuePtr meta)
-    : malValue(meta), m_map(that.m_map), m_isEvaluated(that.m_isEvaluated) { }
+    malHash(const malHash& that, const malValuePtr& meta)
+    : malValue(TYPE_HASH, meta)
+    , m_map(that.m_map), m_isEvaluated(that.m_isEvaluated) { }
 
     malValuePtr assoc(malValueIter argsBegin, malValueIter argsEnd) const;
     malValuePtr dissoc(malValueIter argsBegin, malValueIter argsEnd) const;
-    bool contains(malValuePtr key) const;
-    malValuePtr eval(malEnvPtr env);
-    malValuePtr get(malValuePtr key) const;
+    bool contains(const malValuePtr& key) const;
+    malValuePtr eval(const malEnvPtr& env);
+    malValuePtr get(const malValuePtr& key) const;
     malValuePtr keys() const;
     malValuePtr values() const;
 
@@ -264,11 +867,14 @@ public:
                                     malValueIter argsBegin,
                                     malValueIter argsEnd);
 
+    TYPE_RANGE(TYPE_BUILTIN, TYPE_BUILTIN);
+
     malBuiltIn(const String& name, ApplyFunc* handler)
-    : m_name(name), m_handler(handler) { }
+    : malApplicable(TYPE_BUILTIN), m_name(name), m_handler(handler) { }
 
-    malBuiltIn(const malBuiltIn& that, malValuePtr meta)
-    : malApplicable(meta), m_name(that.m_name), m_handler(that.m_handler) { }
+    malBuiltIn(const malBuiltIn& that, const malValuePtr& meta)
+    : malApplicable(TYPE_BUILTIN, meta)
+    , m_name(that.m_name), m_handler(that.m_handler) { }
 
     virtual malValuePtr apply(malValueIter argsBegin,
                               malValueIter argsEnd) const;
@@ -290,10 +896,43 @@ private:
     ApplyFunc* m_handler;
 };
 
-class malLambda : public malApplicable {
+// A lambda's parameters, resolved to the ids of their symbols when fn* is
+// evaluated, so that a call copies its arguments straight into the slots
+// of its environment. The copies of a lambda which with-meta makes share
+// them.
+class malParams : public RefCounted {
+public:
+    static malParams* create(const malValueVec& bindings);
+
+    TRAILING_STORAGE;
+
+    // Of the parameters before the &, if there is one.
+    const int* ids() const { return reinterpret_cast<const int*>(this + 1); }
+    int fixedCount() const { return m_fixedCount; }
+
+    bool hasRest() const { return m_hasRest; }
+    int restId() const { return m_restId; }     // -1 unless just one follows
+
+private:
+    malParams(int fixedCount, bool hasRest, int restId)
+    : m_fixedCount(fixedCount), m_hasRest(hasRest), m_restId(restId) { }
+
+    int* ids() { return reinterpret_cast<int*>(this + 1); }
+
+    const int m_fixedCount;
+    const bool m_hasRest;
+    const int m_restId;
+};
+
+typedef RefCountedPtr<malParams> malParamsPtr;
+
+class malLambda : public malApplicable, public malTracked {
 public:
-    malLambda(const StringVec& bindings, malValuePtr body, malEnvPtr env);
-    malLambda(const malLambda& that, malValuePtr meta);
+    TYPE_RANGE(TYPE_LAMBDA, TYPE_LAMBDA);
+
+    malLambda(const malValueVec& bindings,
+              const malValuePtr& body, const malEnvPtr& env);
+    malLambda(const malLambda& that, const malValuePtr& meta);
     malLambda(const malLambda& that, bool isMacro);
 
     virtual malValuePtr apply(malValueIter argsBegin,
@@ -312,20 +951,32 @@ public:
 
     bool isMacro() const { return m_isMacro; }
 
-    virtual malValuePtr doWithMeta(malValuePtr meta) const;
+    // Tells this macro apart from every other one, without holding on to
+    // it, for the expansion cache. Copies made by with-meta expand the same
+    // way, so they share it. 0 for functions.
+    unsigned macroId() const { return m_macroId; }
+
+    virtual malValuePtr doWithMeta(const malValuePtr& meta) const;
 
 private:
-    const StringVec   m_bindings;
+    friend class malCollector;
+
+    const malParamsPtr m_params;
     const malValuePtr m_body;
-    const malEnvPtr   m_env;
+    malEnvPtr         m_env; // cleared by the collector to break a cycle
     const bool        m_isMacro;
+    const unsigned    m_macroId;
+
+    static unsigned s_lastMacroId;
 };
 
 class malAtom : public malValue {
 public:
-    malAtom(malValuePtr value) : m_value(value) { }
-    malAtom(const malAtom& that, malValuePtr meta)
-        : malValue(meta), m_value(that.m_value) { }
+    TYPE_RANGE(TYPE_ATOM, TYPE_ATOM);
+
+    malAtom(const malValuePtr& value) : malValue(TYPE_ATOM), m_value(value) { }
+    malAtom(const malAtom& that, const malValuePtr& meta)
+        : malValue(TYPE_ATOM, meta), m_value(that.m_value) { }
 
     virtual bool doIsEqualTo(const malValue* rhs) const {
         return this->m_value->isEqualTo(rhs);
@@ -337,7 +988,7 @@ public:
 
     malValuePtr deref() const { return m_value; }
 
-    malValuePtr reset(malValuePtr value) { return m_value = value; }
+    malValuePtr reset(const malValuePtr& value) { return m_value = value; }
 
     WITH_META(malAtom);
 
@@ -345,30 +996,82 @@ private:
     malValuePtr m_value;
 };
 
+// Appends value->print(readably) to out. Anything which prints as its own
+// characters is appended straight from its buffer, without copying them
+// into a String first.
+extern void printTo(String& out, const malValuePtr& value, bool readably);
+
 namespace mal {
-    malValuePtr atom(malValuePtr value);
+    malValuePtr atom(const malValuePtr& value);
     malValuePtr boolean(bool value);
     malValuePtr builtin(const String& name, malBuiltIn::ApplyFunc handler);
+    malValuePtr cons(const malValuePtr& first, const malValuePtr& rest);
     malValuePtr falseValue();
     malValuePtr hash(malValueIter argsBegin, malValueIter argsEnd,
                      bool isEvaluated);
     malValuePtr hash(const malHash::Map& map);
     malValuePtr integer(int64_t value);
     malValuePtr integer(const String& token);
-    malValuePtr keyword(const String& token);
-    malValuePtr lambda(const StringVec&, malValuePtr, malEnvPtr);
+    malValuePtr keyword(StringView token);
+    malValuePtr lambda(const malValueVec&,
+                       const malValuePtr&, const malEnvPtr&);
+    malValuePtr list();
     malValuePtr list(malValueVec* items);
     malValuePtr list(malValueIter begin, malValueIter end);
-    malValuePtr list(malValuePtr a);
-    malValuePtr list(malValuePtr a, malValuePtr b);
-    malValuePtr list(malValuePtr a, malValuePtr b, malValuePtr c);
+    malValuePtr list(const malValuePtr& a);
+    malValuePtr list(const malValuePtr& a, const malValuePtr& b);
+    malValuePtr list(const malValuePtr& a, const malValuePtr& b,
+                     const malValuePtr& c);
     malValuePtr macro(const malLambda& lambda);
     malValuePtr nilValue();
-    malValuePtr string(const String& token);
-    malValuePtr symbol(const String& token);
+    malValuePtr string(StringView token);
+    malValuePtr string(const malRopePtr& rope);
+    malValuePtr symbol(StringView token);
     malValuePtr trueValue();
+    malValuePtr vector();
     malValuePtr vector(malValueVec* items);
     malValuePtr vector(malValueIter begin, malValueIter end);
+
+    extern malConstant constants[3]; // nil, true, false: see ValuePtr.h
 };
 
+inline malValuePtr::RefCountedPtr(malValue* object)
+: m_bits(reinterpret_cast<uintptr_t>(object))
+{
+    acquire();
+}
+
+inline malValue* malValuePtr::ptr() const
+{
+    if (isHeap() || (m_bits == 0)) {
+        return reinterpret_cast<malValue*>(m_bits);
+    }
+    if (isInteger()) {
+        return NULL;
+    }
+    return &mal::constants[(m_bits >> 1) - 1];
+}
+
+inline malValueArrow malValuePtr::operator -> () const
+{
+    return malValueArrow(*this);
+}
+
+inline void malValuePtr::acquire() const
+{
+    if (isHeap()) {
+        reinterpret_cast<malValue*>(m_bits)->acquire();
+    }
+}
+
+inline void malValuePtr::release() const
+{
+    if (isHeap()) {
+        malValue* object = reinterpret_cast<malValue*>(m_bits);
+        if (object->release() == 0) {
+            delete object;
+        }
+    }
+}
+
 #endif // INCLUDE_TYPES_H
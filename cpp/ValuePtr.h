@@ -0,0 +1,112 @@
+#ifndef INCLUDE_VALUEPTR_H
+#define INCLUDE_VALUEPTR_H
+
+#include "RefCountedPtr.h"
+
+#include <stdint.h>
+
+class malValue;
+class malValueArrow;
+
+// malValuePtr is a tagged word rather than a plain pointer. Small integers
+// and the nil/true/false constants are stored directly in the word, so
+// creating, copying and destroying them never allocates or touches a
+// reference count. Everything else is an ordinary reference-counted object.
+//
+//     ........xxxxxxx1    integer, held in the upper 63 bits
+//     0000000000000010    nil
+//     0000000000000100    true
+//     0000000000000110    false
+//     ........xxxxx000    malValue* (or NULL)
+//
+// The members which need the full malValue definition are defined at the
+// end of Types.h.
+template<>
+class RefCountedPtr<malValue> {
+public:
+    enum {
+        TAG_NIL     = 2,
+        TAG_TRUE    = 4,
+        TAG_FALSE   = 6,
+    };
+
+    RefCountedPtr() : m_bits(0) { }
+
+    RefCountedPtr(malValue* object);
+
+    RefCountedPtr(const RefCountedPtr& rhs) : m_bits(rhs.m_bits)
+    { acquire(); }
+
+    RefCountedPtr(RefCountedPtr&& rhs) : m_bits(rhs.m_bits)
+    { rhs.m_bits = 0; }
+
+    const RefCountedPtr& operator = (const RefCountedPtr& rhs) {
+        // Read rhs before release, in case rhs is owned by us.
+        uintptr_t bits = rhs.m_bits;
+        rhs.acquire();
+        release();
+        m_bits = bits;
+        return *this;
+    }
+
+    const RefCountedPtr& operator = (RefCountedPtr&& rhs) {
+        uintptr_t bits = rhs.m_bits;
+        rhs.m_bits = 0; // before release, in case rhs is owned by us
+        release();
+        m_bits = bits;
+        return *this;
+    }
+
+    ~RefCountedPtr() {
+        release();
+    }
+
+    static RefCountedPtr constant(uintptr_t tag) {
+        return RefCountedPtr(tag, 0);
+    }
+
+    static RefCountedPtr integer(int64_t value) {
+        return RefCountedPtr((static_cast<uintptr_t>(value) << 1) | 1, 0);
+    }
+
+    // Integers outside this range are boxed in a malInteger object.
+    static bool isImmediateInteger(int64_t value) {
+        return (value >= -(INT64_C(1) << 62)) && (value < (INT64_C(1) << 62));
+    }
+
+    bool operator == (const RefCountedPtr& rhs) const {
+        return m_bits == rhs.m_bits;
+    }
+
+    bool operator != (const RefCountedPtr& rhs) const {
+        return m_bits != rhs.m_bits;
+    }
+
+    operator bool () const {
+        return m_bits != 0;
+    }
+
+    bool isHeap() const { return ((m_bits & 1) == 0) && (m_bits >= 8); }
+    bool isInteger() const { return (m_bits & 1) != 0; }
+    bool isImmediate() const { return !isHeap() && (m_bits != 0); }
+    bool isTrue() const { return (m_bits != TAG_NIL) && (m_bits != TAG_FALSE); }
+
+    int64_t integerValue() const {
+        return static_cast<intptr_t>(m_bits) >> 1;
+    }
+
+    // Returns NULL for an unboxed integer, as there is no object to point
+    // at. Use operator -> to call malValue methods on any value.
+    malValue* ptr() const;
+    malValueArrow operator -> () const;
+
+private:
+    RefCountedPtr(uintptr_t bits, int) : m_bits(bits) { }
+
+    void acquire() const;
+    void release() const;
+
+    uintptr_t m_bits;
+};
+
+#endif // INCLUDE_VALUEPTR_H
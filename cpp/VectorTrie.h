@@ -0,0 +1,257 @@
+#ifndef INCLUDE_VECTORTRIE_H
+#define INCLUDE_VECTORTRIE_H
+
+#include "RefCountedPtr.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// The body of a persistent vector: a 32-way bit-partitioned trie of full
+// leaves. The vector keeps its last 1-32 elements in a tail of its own and
+// hands them over with pushLeaf once it has a leaf's worth, so the trie is
+// only touched once every 32 elements. pushLeaf and set return a new trie
+// which shares everything but the O(log32 n) nodes on the changed path with
+// the original.
+//
+// As leaves are always full, every element can be found by taking 5 bits
+// of its index per level.
+template<class T>
+class VectorTrie {
+    enum {
+        BITS    = 5,
+        MASK    = (1 << BITS) - 1,
+    };
+
+    class Node;
+
+public:
+    enum { LEAF_SIZE = 1 << BITS };
+
+    VectorTrie() : m_root(NULL), m_size(0), m_shift(BITS) { }
+
+    // Builds a trie of leafCount leaves from the elements starting at begin.
+    template<class Iter>
+    VectorTrie(Iter begin, int leafCount)
+    : m_root(NULL), m_size(leafCount * LEAF_SIZE), m_shift(BITS) {
+        if (leafCount == 0) {
+            return;
+        }
+        std::vector<Node*> nodes;
+        for (int i = 0; i < leafCount; i++) {
+            Node* leaf = Node::leaf();
+            for (int j = 0; j < LEAF_SIZE; ++j, ++begin) {
+                new (leaf->items() + j) T(*begin);
+            }
+            leaf->m_size = LEAF_SIZE;
+            nodes.push_back(leaf);
+        }
+        // Build the trie bottom-up from the leaves.
+        while (nodes.size() > LEAF_SIZE) {
+            std::vector<Node*> parents;
+            for (size_t i = 0; i < nodes.size(); i += LEAF_SIZE) {
+                size_t count = std::min<size_t>(LEAF_SIZE, nodes.size() - i);
+                parents.push_back(Node::branch(&nodes[i], count));
+            }
+            nodes.swap(parents);
+            m_shift += BITS;
+        }
+        setNode(m_root, Node::branch(&nodes[0], nodes.size()));
+    }
+
+    VectorTrie(const VectorTrie& that)
+    : m_root(that.m_root), m_size(that.m_size), m_shift(that.m_shift) {
+        acquire(m_root);
+    }
+
+    VectorTrie& operator = (const VectorTrie& that) {
+        setNode(m_root, that.m_root);
+        m_size  = that.m_size;
+        m_shift = that.m_shift;
+        return *this;
+    }
+
+    ~VectorTrie() {
+        release(m_root);
+    }
+
+    // The number of elements, which is always a multiple of LEAF_SIZE.
+    int size() const { return m_size; }
+
+    const T& operator [] (int index) const {
+        int length;
+        return *run(index, length);
+    }
+
+    // Returns the contiguous run of elements which starts at index, and
+    // sets length to the number of elements in it.
+    const T* run(int index, int& length) const {
+        const Node* node = m_root;
+        for (int level = m_shift; level > 0; level -= BITS) {
+            node = node->children()[(index >> level) & MASK];
+        }
+        length = LEAF_SIZE - (index & MASK);
+        return node->items() + (index & MASK);
+    }
+
+    // Appends a leaf holding the LEAF_SIZE elements starting at items.
+    VectorTrie pushLeaf(const T* items) const {
+        Node* leaf = Node::leaf();
+        for (int i = 0; i < LEAF_SIZE; i++) {
+            new (leaf->items() + i) T(items[i]);
+        }
+        leaf->m_size = LEAF_SIZE;
+
+        VectorTrie result(*this);
+        Node* root;
+        if ((m_size >> BITS) >= (1 << m_shift)) {
+            // The root is full, so the trie grows a level.
+            Node* children[2] = { m_root, newPath(m_shift, leaf) };
+            root = Node::branch(children, 2);
+            result.m_shift += BITS;
+        }
+        else {
+            root = pushLeaf(m_shift, m_root, leaf);
+        }
+        result.setNode(result.m_root, root);
+        result.m_size += LEAF_SIZE;
+        return result;
+    }
+
+    VectorTrie set(int index, const T& value) const {
+        VectorTrie result(*this);
+        result.setNode(result.m_root, setIn(m_shift, m_root, index, value));
+        return result;
+    }
+
+private:
+    // Leaves hold items and branches hold children, both in an array of
+    // LEAF_SIZE slots allocated along with the node.
+    class Node : public RefCounted {
+    public:
+        static Node* leaf() {
+            void* memory = ::operator new(sizeof(Node) + LEAF_SIZE * sizeof(T));
+            return new (memory) Node(true);
+        }
+
+        static Node* branch(Node* const* children, int count) {
+            void* memory =
+                ::operator new(sizeof(Node) + LEAF_SIZE * sizeof(Node*));
+            Node* node = new (memory) Node(false);
+            for (int i = 0; i < count; i++) {
+                VectorTrie::acquire(children[i]);
+                node->children()[i] = children[i];
+            }
+            node->m_size = count;
+            return node;
+        }
+
+        ~Node() {
+            for (int i = 0; i < m_size; i++) {
+                if (m_isLeaf) {
+                    items()[i].~T();
+                }
+                else {
+                    VectorTrie::release(children()[i]);
+                }
+            }
+        }
+
+        static void operator delete(void* memory) {
+            ::operator delete(memory);
+        }
+
+        T* items() const {
+            return reinterpret_cast<T*>(const_cast<Node*>(this) + 1);
+        }
+
+        Node** children() const {
+            return reinterpret_cast<Node**>(const_cast<Node*>(this) + 1);
+        }
+
+        int m_size;
+        const bool m_isLeaf;
+
+    private:
+        explicit Node(bool isLeaf) : m_size(0), m_isLeaf(isLeaf) { }
+    };
+
+    static void acquire(const Node* node) {
+        if (node != NULL) {
+            node->acquire();
+        }
+    }
+
+    static void release(const Node* node) {
+        if ((node != NULL) && (node->release() == 0)) {
+            delete node;
+        }
+    }
+
+    static void setNode(Node*& slot, Node* node) {
+        acquire(node);
+        release(slot);
+        slot = node;
+    }
+
+    static Node* newPath(int level, Node* leaf) {
+        if (level == 0) {
+            return leaf;
+        }
+        Node* child = newPath(level - BITS, leaf);
+        return Node::branch(&child, 1);
+    }
+
+    // Returns a copy of parent (which may be NULL) with leaf added after
+    // all the leaves already below it.
+    Node* pushLeaf(int level, const Node* parent, Node* leaf) const {
+        int index = (m_size >> level) & MASK;
+        int size = parent ? parent->m_size : 0;
+        Node* result = Node::branch(parent ? parent->children() : NULL, size);
+
+        Node* child;
+        if (level == BITS) {
+            child = leaf;
+        }
+        else if (index < size) {
+            child = pushLeaf(level - BITS, parent->children()[index], leaf);
+        }
+        else {
+            child = newPath(level - BITS, leaf);
+        }
+        acquire(child);
+        if (index < size) {
+            release(result->children()[index]);
+        }
+        else {
+            result->m_size++;
+        }
+        result->children()[index] = child;
+        return result;
+    }
+
+    static Node* setIn(int level, const Node* node, int index, const T& value) {
+        if (level == 0) {
+            Node* result = Node::leaf();
+            for (int i = 0; i < LEAF_SIZE; i++) {
+                new (result->items() + i)
+                    T(i == (index & MASK) ? value : node->items()[i]);
+            }
+            result->m_size = LEAF_SIZE;
+            return result;
+        }
+        int slot = (index >> level) & MASK;
+        Node* result = Node::branch(node->children(), node->m_size);
+        Node* child = setIn(level - BITS, node->children()[slot], index, value);
+        acquire(child);
+        release(result->children()[slot]);
+        result->children()[slot] = child;
+        return result;
+    }
+
+    Node* m_root;
+    int m_size;
+    int m_shift;
+};
+
+#endif // INCLUDE_VECTORTRIE_H
@@ -0,0 +1,32 @@
+#include "Bench.h"
+
+#include <cstdio>
+
+void report(const String& name, double nanos)
+{
+    printf("%-44s %12.1f ns\n", name.c_str(), nanos);
+}
+
+// The benchmarks exercise the runtime directly, and never evaluate mal
+// code, so these are never called.
+
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
+{
+    MAL_FAIL("APPLY is not available in benchmarks");
+}
+
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
+{
+    MAL_FAIL("EVAL is not available in benchmarks");
+}
+
+malValuePtr readline(const String& prompt)
+{
+    MAL_FAIL("readline is not available in benchmarks");
+}
+
+String rep(const String& input, const malEnvPtr& env)
+{
+    MAL_FAIL("rep is not available in benchmarks");
+}
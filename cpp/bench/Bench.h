@@ -0,0 +1,35 @@
+#ifndef INCLUDE_BENCH_H
+#define INCLUDE_BENCH_H
+
+#include "MAL.h"
+
+#include <chrono>
+
+// Helpers shared by the micro-benchmarks in this directory. Each benchmark
+// is a standalone program linked against libmal.a and Bench.o, which
+// stands in for the step*.cpp entry points that libmal.a expects.
+
+// Runs body() the given number of times and returns the mean time per run
+// in nanoseconds.
+template<class F>
+double timeRuns(int runs, F body)
+{
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        body();
+    }
+    auto elapsed = steady_clock::now() - start;
+    return duration_cast<nanoseconds>(elapsed).count() / double(runs);
+}
+
+// Stops the compiler from discarding a computation whose result is unused.
+template<class T>
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+extern void report(const String& name, double nanos);
+
+#endif // INCLUDE_BENCH_H
@@ -0,0 +1,96 @@
+#include "Bench.h"
+#include "Types.h"
+
+#include <cstdio>
+#include <typeinfo>
+
+// Compares the type-range checks behind DYNAMIC_CAST with the RTTI they
+// replaced: dynamic_cast for the casts, and typeid for the same-type test
+// in malValue::isEqualTo.
+
+// One of each kind of heap value, repeated.
+static malValueVec makeValues()
+{
+    malValueVec values;
+    for (int i = 0; i < 8; i++) {
+        values.push_back(mal::list(mal::integer(i)));
+        values.push_back(mal::cons(mal::integer(i), mal::list()));
+        values.push_back(mal::vector());
+        values.push_back(mal::symbol(STRF("sym%d", i)));
+        values.push_back(mal::string(STRF("str%d", i)));
+        values.push_back(mal::keyword(STRF(":kw%d", i)));
+        values.push_back(mal::atom(mal::nilValue()));
+        values.push_back(mal::hash(malHash::Map()));
+    }
+    return values;
+}
+
+template<class T>
+static int countRtti(const malValueVec& values)
+{
+    int found = 0;
+    for (auto& value : values) {
+        found += dynamic_cast<T*>(value.ptr()) != NULL;
+    }
+    return found;
+}
+
+template<class T>
+static int countTagged(const malValueVec& values)
+{
+    int found = 0;
+    for (auto& value : values) {
+        found += DYNAMIC_CAST(T, value) != NULL;
+    }
+    return found;
+}
+
+template<class T>
+static bool matches(const malValueVec& values)
+{
+    return countRtti<T>(values) == countTagged<T>(values);
+}
+
+template<class T>
+static void compare(const char* name, const malValueVec& values, int runs)
+{
+    report(STRF("%-14s dynamic_cast", name), timeRuns(runs, [&] {
+        keep(countRtti<T>(values));
+    }) / values.size());
+    report(STRF("%-14s type range", name), timeRuns(runs, [&] {
+        keep(countTagged<T>(values));
+    }) / values.size());
+}
+
+int main(int argc, char* argv[])
+{
+    malValueVec values = makeValues();
+    const int runs = 200000;
+
+    if (!matches<malList>(values) || !matches<malSequence>(values) ||
+        !matches<malStringBase>(values) || !matches<malApplicable>(values)) {
+        fprintf(stderr, "type ranges do not match dynamic_cast\n");
+        return 1;
+    }
+
+    compare<malList>("malList", values, runs);
+    compare<malSequence>("malSequence", values, runs);
+    compare<malSymbol>("malSymbol", values, runs);
+    compare<malApplicable>("malApplicable", values, runs);
+
+    report("same type      typeid", timeRuns(runs, [&] {
+        int same = 0;
+        for (size_t i = 1; i < values.size(); i++) {
+            same += typeid(*values[i-1].ptr()) == typeid(*values[i].ptr());
+        }
+        keep(same);
+    }) / values.size());
+    report("same type      type()", timeRuns(runs, [&] {
+        int same = 0;
+        for (size_t i = 1; i < values.size(); i++) {
+            same += values[i-1].ptr()->type() == values[i].ptr()->type();
+        }
+        keep(same);
+    }) / values.size());
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "Bench.h"
+#include "Environment.h"
+#include "Types.h"
+
+#include <cstdio>
+#include <unordered_map>
+
+// Times malEnv get, set and find, for global environments of various sizes
+// and for lookups through chains of call frames of various depths, and
+// compares the IdTable behind the bindings beyond the slots with the
+// std::unordered_map it replaced.
+
+typedef std::unordered_map<int, malValuePtr> StdMap;
+
+static const int sizes[] = { 4, 16, 64, 256, 1024 };
+static const int depths[] = { 1, 4, 16, 64 };
+
+static const malSymbol* symbolNamed(const String& name)
+{
+    return STATIC_CAST(malSymbol, mal::symbol(name));
+}
+
+static std::vector<const malSymbol*> makeSymbols(const char* prefix,
+                                                 int count)
+{
+    std::vector<const malSymbol*> symbols;
+    for (int i = 0; i < count; i++) {
+        symbols.push_back(symbolNamed(STRF("%s%d", prefix, i)));
+    }
+    return symbols;
+}
+
+static void benchTables(const std::vector<const malSymbol*>& symbols)
+{
+    malValuePtr value = mal::integer(1);
+    for (int size : sizes) {
+        int runs = 200000 / size + 10;
+        IdTable<malValuePtr> table;
+        StdMap map;
+        for (int i = 0; i < size; i++) {
+            table[symbols[i]->id()] = value;
+            map[symbols[i]->id()] = value;
+        }
+        int id = symbols[size / 2]->id();
+        int missing = symbols[size]->id();
+
+        report(STRF("build   size %-6d IdTable", size), timeRuns(runs, [&] {
+            IdTable<malValuePtr> built;
+            for (int i = 0; i < size; i++) {
+                built[symbols[i]->id()] = value;
+            }
+        }));
+        report(STRF("build   size %-6d unordered_map", size), timeRuns(runs, [&] {
+            StdMap built;
+            for (int i = 0; i < size; i++) {
+                built[symbols[i]->id()] = value;
+            }
+        }));
+        report(STRF("find    size %-6d IdTable", size), timeRuns(runs * 100, [&] {
+            keep(table.find(id));
+        }));
+        report(STRF("find    size %-6d unordered_map", size), timeRuns(runs * 100, [&] {
+            keep(map.find(id));
+        }));
+        report(STRF("miss    size %-6d IdTable", size), timeRuns(runs * 100, [&] {
+            keep(table.find(missing));
+        }));
+        report(STRF("miss    size %-6d unordered_map", size), timeRuns(runs * 100, [&] {
+            keep(map.find(missing));
+        }));
+    }
+}
+
+static void benchGlobals(const std::vector<const malSymbol*>& symbols)
+{
+    malValuePtr value = mal::integer(1);
+    for (int size : sizes) {
+        int runs = 2000000;
+        malEnvPtr env(new malEnv);
+        for (int i = 0; i < size; i++) {
+            env->set(symbols[i], value);
+        }
+        const malSymbol* symbol = symbols[size / 2];
+
+        // get goes through the cache on the symbol, find searches.
+        report(STRF("env get  global size %-6d", size), timeRuns(runs, [&] {
+            keep(env->get(symbol));
+        }));
+        report(STRF("env find global size %-6d", size), timeRuns(runs, [&] {
+            keep(env->find(symbol));
+        }));
+        report(STRF("env set  global size %-6d", size), timeRuns(runs, [&] {
+            env->set(symbol, value);
+        }));
+    }
+}
+
+// Each frame binds three names in slots, as a call would.
+static void benchChains(const std::vector<const malSymbol*>& globals)
+{
+    malValuePtr value = mal::integer(1);
+    const malSymbol* global = globals[0];
+    std::vector<const malSymbol*> params = makeSymbols("param", 3);
+    for (const malSymbol* param : params) {
+        malEnv::bindsLocally(param);
+    }
+
+    for (int depth : depths) {
+        int runs = 2000000 / depth;
+        malEnvPtr root(new malEnv);
+        root->set(global, value);
+        malEnvPtr env = root;
+        for (int i = 0; i < depth; i++) {
+            env = malEnv::create(env, params.size());
+            for (const malSymbol* param : params) {
+                env->set(param, value);
+            }
+        }
+        const malSymbol* local = params[0];
+
+        report(STRF("env get  local  depth %-4d", depth), timeRuns(runs, [&] {
+            keep(env->get(local));
+        }));
+        report(STRF("env get  global depth %-4d", depth), timeRuns(runs, [&] {
+            keep(env->get(global));
+        }));
+        report(STRF("env find global depth %-4d", depth), timeRuns(runs, [&] {
+            keep(env->find(global));
+        }));
+        report(STRF("env set  local  depth %-4d", depth), timeRuns(runs, [&] {
+            env->set(local, value);
+        }));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    std::vector<const malSymbol*> symbols = makeSymbols("global", largest + 1);
+
+    benchTables(symbols);
+    benchGlobals(symbols);
+    benchChains(symbols);
+    return 0;
+}
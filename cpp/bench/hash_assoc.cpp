@@ -0,0 +1,124 @@
+#include "Bench.h"
+#include "Types.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+// Compares the persistent HashTrie behind malHash with the representation
+// it replaced, where every assoc and dissoc copied a std::map keyed by the
+// printed form of the key.
+
+typedef std::map<String, malValuePtr> CopyMap;
+
+static const int sizes[] = { 8, 64, 512, 4096, 32768 };
+
+static malValueVec makeKeys(int count)
+{
+    malValueVec keys;
+    for (int i = 0; i < count; i++) {
+        keys.push_back(mal::keyword(STRF(":key%d", i)));
+    }
+    return keys;
+}
+
+static malHash::Map makeTrie(const malValueVec& keys, int count)
+{
+    malHash::Map map;
+    for (int i = 0; i < count; i++) {
+        map.insert(keys[i], mal::integer(i));
+    }
+    return map;
+}
+
+static CopyMap makeCopyMap(const malValueVec& keys, int count)
+{
+    CopyMap map;
+    for (int i = 0; i < count; i++) {
+        map[keys[i]->print(true)] = mal::integer(i);
+    }
+    return map;
+}
+
+// Checks the trie against a std::map through a random series of assoc and
+// dissoc operations, keeping every intermediate version alive so that
+// structural sharing bugs show up as changes to older versions.
+static bool verify(const malValueVec& keys)
+{
+    std::vector<malHash::Map> tries(1);
+    std::vector<CopyMap> copies(1);
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        const malValuePtr& key = keys[rand() % keys.size()];
+        if (rand() % 3 == 0) {
+            tries.push_back(tries.back().dissoc(key));
+            copies.push_back(copies.back());
+            copies.back().erase(key->print(true));
+        }
+        else {
+            tries.push_back(tries.back().assoc(key, mal::integer(i)));
+            copies.push_back(copies.back());
+            copies.back()[key->print(true)] = mal::integer(i);
+        }
+    }
+
+    for (size_t v = 0; v < tries.size(); v++) {
+        if (tries[v].size() != (int)copies[v].size()) {
+            return false;
+        }
+        int visited = 0;
+        for (auto it = tries[v].begin(), end = tries[v].end();
+             it != end; ++it, ++visited) {
+            auto found = copies[v].find(it->first->print(true));
+            if ((found == copies[v].end()) || (found->second != it->second)) {
+                return false;
+            }
+        }
+        if (visited != tries[v].size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    int largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    malValueVec keys = makeKeys(largest + 1);
+
+    if (!verify(malValueVec(keys.begin(), keys.begin() + 2000))) {
+        fprintf(stderr, "HashTrie does not match std::map\n");
+        return 1;
+    }
+
+    for (int size : sizes) {
+        int runs = 200000 / size + 10;
+        malHash::Map trie = makeTrie(keys, size);
+        CopyMap copy = makeCopyMap(keys, size);
+        const malValuePtr& newKey = keys[size];
+        const malValuePtr& oldKey = keys[size / 2];
+        malValuePtr value = mal::integer(-1);
+
+        report(STRF("assoc   size %-6d HashTrie", size), timeRuns(runs, [&] {
+            malHash::Map result = trie.assoc(newKey, value);
+        }));
+        report(STRF("assoc   size %-6d std::map copy", size), timeRuns(runs, [&] {
+            CopyMap result(copy);
+            result[newKey->print(true)] = value;
+        }));
+        report(STRF("dissoc  size %-6d HashTrie", size), timeRuns(runs, [&] {
+            malHash::Map result = trie.dissoc(oldKey);
+        }));
+        report(STRF("dissoc  size %-6d std::map copy", size), timeRuns(runs, [&] {
+            CopyMap result(copy);
+            result.erase(oldKey->print(true));
+        }));
+        report(STRF("get     size %-6d HashTrie", size), timeRuns(runs * 10, [&] {
+            keep(trie.find(oldKey));
+        }));
+        report(STRF("get     size %-6d std::map", size), timeRuns(runs * 10, [&] {
+            keep(copy.find(oldKey->print(true)));
+        }));
+    }
+    return 0;
+}
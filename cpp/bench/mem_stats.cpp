@@ -0,0 +1,66 @@
+#include "Bench.h"
+#include "Types.h"
+
+#include <cstdio>
+
+// Reports the memory taken by large data sets, as the pool bytes still in
+// use once each set is built, so that changes to the layout of the values
+// can be compared.
+
+static const int ITEMS = 100000;
+
+template<class Build>
+static void measure(const char* name, Build build)
+{
+    size_t before = pool::stats.inUse;
+    malValuePtr value = build();
+    size_t used = pool::stats.inUse - before;
+    printf("%-32s %10zu bytes %8.1f bytes/item\n",
+           name, used, double(used) / ITEMS);
+}
+
+int main(int argc, char* argv[])
+{
+    printf("sizeof: malValue %zu, malInteger %zu, malString %zu, "
+           "malListCell %zu, malListView %zu, malVector %zu, malHash %zu\n",
+           sizeof(malValue), sizeof(malInteger), sizeof(malString),
+           sizeof(malListCell), sizeof(malListView), sizeof(malVector),
+           sizeof(malHash));
+
+    measure("list of boxed integers", [] {
+        malValuePtr list = mal::list();
+        for (int i = 0; i < ITEMS; i++) {
+            list = mal::cons(mal::integer(INT64_MAX - i), list);
+        }
+        return list;
+    });
+    measure("list of strings", [] {
+        malValuePtr list = mal::list();
+        for (int i = 0; i < ITEMS; i++) {
+            list = mal::cons(mal::string(STRF("s%d", i)), list);
+        }
+        return list;
+    });
+    measure("vector of strings", [] {
+        malValueVec* items = new malValueVec;
+        for (int i = 0; i < ITEMS; i++) {
+            items->push_back(mal::string(STRF("s%d", i)));
+        }
+        return mal::vector(items);
+    });
+    measure("list of pairs", [] {
+        malValueVec* items = new malValueVec;
+        for (int i = 0; i < ITEMS; i++) {
+            items->push_back(mal::list(mal::integer(i), mal::integer(-i)));
+        }
+        return mal::list(items);
+    });
+    measure("hash map of strings", [] {
+        malHash::Map map;
+        for (int i = 0; i < ITEMS; i++) {
+            map.insert(mal::string(STRF("k%d", i)), mal::integer(i));
+        }
+        return mal::hash(map);
+    });
+    return 0;
+}
@@ -7,7 +7,7 @@
 #include <memory>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
+String PRINT(const malValuePtr& ast);
 
 static ReadLine s_readLine("~/.mal-history");
 
@@ -49,18 +49,18 @@ static malValuePtr EVAL(malValuePtr ast)
     return ast;
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
 // These have been added after step 1 to keep the linker happy.
-malValuePtr EVAL(malValuePtr ast, malEnvPtr)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr&)
 {
     return ast;
 }
 
-malValuePtr APPLY(malValuePtr ast, malValueIter, malValueIter)
+malValuePtr APPLY(const malValuePtr& ast, malValueIter, malValueIter)
 {
     return ast;
 }
@@ -8,7 +8,7 @@
 #include <memory>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
+String PRINT(const malValuePtr& ast);
 
 static ReadLine s_readLine("~/.mal-history");
 static malBuiltIn::ApplyFunc
@@ -39,7 +39,7 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-String rep(const String& input, malEnvPtr env)
+String rep(const String& input, const malEnvPtr& env)
 {
     return PRINT(EVAL(READ(input), env));
 }
@@ -49,17 +49,19 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
 {
+    COUNT_REF(evals);
     return ast->eval(env);
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -68,7 +70,7 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
     return handler->apply(argsBegin, argsEnd);
 }
 
-#define ARG(type, name) type* name = VALUE_CAST(type, *argsBegin++)
+#define ARG(type, name) auto name = VALUE_CAST(type, *argsBegin++)
 
 #define CHECK_ARGS_IS(expected) \
     checkArgsIs(name.c_str(), expected, std::distance(argsBegin, argsEnd))
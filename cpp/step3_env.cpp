@@ -1,5 +1,6 @@
 #include "MAL.h"
 
+#include "ArgStack.h"
 #include "Environment.h"
 #include "ReadLine.h"
 #include "Types.h"
@@ -8,7 +9,7 @@
 #include <memory>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
+String PRINT(const malValuePtr& ast);
 
 static ReadLine s_readLine("~/.mal-history");
 
@@ -35,7 +36,7 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-String rep(const String& input, malEnvPtr env)
+String rep(const String& input, const malEnvPtr& env)
 {
     return PRINT(EVAL(READ(input), env));
 }
@@ -45,11 +46,12 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
 {
     if (!env) {
-        env = replEnv;
+        return EVAL(ast, replEnv);
     }
+    COUNT_REF(evals);
     const malList* list = DYNAMIC_CAST(malList, ast);
     if (!list || (list->count() == 0)) {
         return ast->eval(env);
@@ -58,13 +60,13 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
     // From here on down we are evaluating a non-empty list.
     // First handle the special forms.
     if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-        String special = symbol->value();
+        StringView special = symbol->value();
         int argCount = list->count() - 1;
 
         if (special == "def!") {
             checkArgsIs("def!", 2, argCount);
             const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-            return env->set(id->value(), EVAL(list->item(2), env));
+            return env->set(id, EVAL(list->item(2), env));
         }
 
         if (special == "let*") {
@@ -72,28 +74,30 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
             const malSequence* bindings =
                 VALUE_CAST(malSequence, list->item(1));
             int count = checkArgsEven("let*", bindings->count());
-            malEnvPtr inner(new malEnv(env));
+            malEnvPtr inner(malEnv::create(env, count / 2));
             for (int i = 0; i < count; i += 2) {
                 const malSymbol* var =
                     VALUE_CAST(malSymbol, bindings->item(i));
-                inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                inner->set(var, EVAL(bindings->item(i+1), inner));
             }
             return EVAL(list->item(2), inner);
         }
     }
 
     // Now we're left with the case of a regular list to be evaluated.
-    std::unique_ptr<malValueVec> items(list->evalItems(env));
-    malValuePtr op = items->at(0);
-    return APPLY(op, items->begin()+1, items->end());
+    malArgs items(list->count());
+    list->evalItems(items.begin(), env);
+    const malValuePtr& op = items[0];
+    return APPLY(op, items.begin()+1, items.end());
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -1,5 +1,6 @@
 #include "MAL.h"
 
+#include "ArgStack.h"
 #include "Environment.h"
 #include "ReadLine.h"
 #include "Types.h"
@@ -8,8 +9,9 @@
 #include <memory>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
-static void installFunctions(malEnvPtr env);
+String PRINT(const malValuePtr& ast);
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env);
+static void installFunctions(const malEnvPtr& env);
 
 static ReadLine s_readLine("~/.mal-history");
 
@@ -37,7 +39,7 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-String rep(const String& input, malEnvPtr env)
+String rep(const String& input, const malEnvPtr& env)
 {
     return PRINT(EVAL(READ(input), env));
 }
@@ -47,12 +49,26 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
 {
     if (!env) {
-        env = replEnv;
+        return EVAL(ast, replEnv);
     }
+    const malList* list = DYNAMIC_CAST(malList, ast);
+    if (!list || (list->count() == 0)) {
+        COUNT_REF(evals);
+        return ast->eval(env);
+    }
+
+    // Only lists go round the TCO loop, which needs references of its own
+    // to ast and env. Anything else is evaluated without copying them.
+    return evalList(ast, env);
+}
+
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env)
+{
     while (1) {
+        COUNT_REF(evals);
         const malList* list = DYNAMIC_CAST(malList, ast);
         if (!list || (list->count() == 0)) {
             return ast->eval(env);
@@ -61,88 +77,90 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
         // From here on down we are evaluating a non-empty list.
         // First handle the special forms.
         if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-            String special = symbol->value();
             int argCount = list->count() - 1;
 
-            if (special == "def!") {
-                checkArgsIs("def!", 2, argCount);
-                const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                return env->set(id->value(), EVAL(list->item(2), env));
-            }
+            switch (symbol->id()) {
+                case SPECIAL_DEF: {
+                    checkArgsIs("def!", 2, argCount);
+                    const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
+                    return env->set(id, EVAL(list->item(2), env));
+                }
 
-            if (special == "do") {
-                checkArgsAtLeast("do", 1, argCount);
+                case SPECIAL_DO: {
+                    checkArgsAtLeast("do", 1, argCount);
 
-                for (int i = 1; i < argCount; i++) {
-                    EVAL(list->item(i), env);
+                    for (int i = 1; i < argCount; i++) {
+                        EVAL(list->item(i), env);
+                    }
+                    ast = list->item(argCount);
+                    continue; // TCO
                 }
-                ast = list->item(argCount);
-                continue; // TCO
-            }
 
-            if (special == "fn*") {
-                checkArgsIs("fn*", 2, argCount);
+                case SPECIAL_FN: {
+                    checkArgsIs("fn*", 2, argCount);
 
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                StringVec params;
-                for (int i = 0; i < bindings->count(); i++) {
-                    const malSymbol* sym =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    params.push_back(sym->value());
-                }
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    malValueVec params;
+                    for (int i = 0; i < bindings->count(); i++) {
+                        params.push_back(
+                            VALUE_CAST(malSymbol, bindings->item(i)));
+                    }
 
-                return mal::lambda(params, list->item(2), env);
-            }
+                    return mal::lambda(params, list->item(2), env);
+                }
 
-            if (special == "if") {
-                checkArgsBetween("if", 2, 3, argCount);
+                case SPECIAL_IF: {
+                    checkArgsBetween("if", 2, 3, argCount);
 
-                bool isTrue = EVAL(list->item(1), env)->isTrue();
-                if (!isTrue && (argCount == 2)) {
-                    return mal::nilValue();
+                    bool isTrue = EVAL(list->item(1), env).isTrue();
+                    if (!isTrue && (argCount == 2)) {
+                        return mal::nilValue();
+                    }
+                    ast = list->item(isTrue ? 2 : 3);
+                    continue; // TCO
                 }
-                ast = list->item(isTrue ? 2 : 3);
-                continue; // TCO
-            }
 
-            if (special == "let*") {
-                checkArgsIs("let*", 2, argCount);
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                int count = checkArgsEven("let*", bindings->count());
-                malEnvPtr inner(new malEnv(env));
-                for (int i = 0; i < count; i += 2) {
-                    const malSymbol* var =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                case SPECIAL_LET: {
+                    checkArgsIs("let*", 2, argCount);
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    int count = checkArgsEven("let*", bindings->count());
+                    malEnvPtr inner(malEnv::create(env, count / 2));
+                    for (int i = 0; i < count; i += 2) {
+                        const malSymbol* var =
+                            VALUE_CAST(malSymbol, bindings->item(i));
+                        inner->set(var, EVAL(bindings->item(i+1), inner));
+                    }
+                    ast = list->item(2);
+                    env = inner;
+                    continue; // TCO
                 }
-                ast = list->item(2);
-                env = inner;
-                continue; // TCO
             }
         }
 
         // Now we're left with the case of a regular list to be evaluated.
-        std::unique_ptr<malValueVec> items(list->evalItems(env));
-        malValuePtr op = items->at(0);
+        malArgs items(list->count());
+        list->evalItems(items.begin(), env);
+        const malValuePtr& op = items[0];
         if (const malLambda* lambda = DYNAMIC_CAST(malLambda, op)) {
             ast = lambda->getBody();
-            env = lambda->makeEnv(items->begin()+1, items->end());
+            env = lambda->makeEnv(items.begin()+1, items.end());
             continue; // TCO
         }
         else {
-            return APPLY(op, items->begin()+1, items->end());
+            return APPLY(op, items.begin()+1, items.end());
         }
     }
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -159,7 +177,7 @@ static const char* malFunctionTable[] = {
     "(def! > (fn* (a b) (not (<= a b))))",
 };
 
-static void installFunctions(malEnvPtr env) {
+static void installFunctions(const malEnvPtr& env) {
     for (auto &function : malFunctionTable) {
         rep(function, env);
     }
@@ -1,5 +1,6 @@
 #include "MAL.h"
 
+#include "ArgStack.h"
 #include "Environment.h"
 #include "ReadLine.h"
 #include "Types.h"
@@ -8,12 +9,13 @@
 #include <memory>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
-static void installFunctions(malEnvPtr env);
+String PRINT(const malValuePtr& ast);
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env);
+static void installFunctions(const malEnvPtr& env);
 
-static void makeArgv(malEnvPtr env, int argc, char* argv[]);
-static String safeRep(const String& input, malEnvPtr env);
-static malValuePtr quasiquote(malValuePtr obj);
+static void makeArgv(const malEnvPtr& env, int argc, char* argv[]);
+static String safeRep(const String& input, const malEnvPtr& env);
+static malValuePtr quasiquote(const malValuePtr& obj);
 
 static ReadLine s_readLine("~/.mal-history");
 
@@ -39,7 +41,7 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-static String safeRep(const String& input, malEnvPtr env)
+static String safeRep(const String& input, const malEnvPtr& env)
 {
     try {
         return rep(input, env);
@@ -52,7 +54,7 @@ static String safeRep(const String& input, malEnvPtr env)
     };
 }
 
-static void makeArgv(malEnvPtr env, int argc, char* argv[])
+static void makeArgv(const malEnvPtr& env, int argc, char* argv[])
 {
     malValueVec* args = new malValueVec();
     for (int i = 0; i < argc; i++) {
@@ -61,7 +63,7 @@ static void makeArgv(malEnvPtr env, int argc, char* argv[])
     env->set("*ARGV*", mal::list(args));
 }
 
-String rep(const String& input, malEnvPtr env)
+String rep(const String& input, const malEnvPtr& env)
 {
     return PRINT(EVAL(READ(input), env));
 }
@@ -71,12 +73,26 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
 {
     if (!env) {
-        env = replEnv;
+        return EVAL(ast, replEnv);
     }
+    const malList* list = DYNAMIC_CAST(malList, ast);
+    if (!list || (list->count() == 0)) {
+        COUNT_REF(evals);
+        return ast->eval(env);
+    }
+
+    // Only lists go round the TCO loop, which needs references of its own
+    // to ast and env. Anything else is evaluated without copying them.
+    return evalList(ast, env);
+}
+
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env)
+{
     while (1) {
+        COUNT_REF(evals);
         const malList* list = DYNAMIC_CAST(malList, ast);
         if (!list || (list->count() == 0)) {
             return ast->eval(env);
@@ -85,99 +101,101 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
         // From here on down we are evaluating a non-empty list.
         // First handle the special forms.
         if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-            String special = symbol->value();
             int argCount = list->count() - 1;
 
-            if (special == "def!") {
-                checkArgsIs("def!", 2, argCount);
-                const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                return env->set(id->value(), EVAL(list->item(2), env));
-            }
+            switch (symbol->id()) {
+                case SPECIAL_DEF: {
+                    checkArgsIs("def!", 2, argCount);
+                    const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
+                    return env->set(id, EVAL(list->item(2), env));
+                }
 
-            if (special == "do") {
-                checkArgsAtLeast("do", 1, argCount);
+                case SPECIAL_DO: {
+                    checkArgsAtLeast("do", 1, argCount);
 
-                for (int i = 1; i < argCount; i++) {
-                    EVAL(list->item(i), env);
+                    for (int i = 1; i < argCount; i++) {
+                        EVAL(list->item(i), env);
+                    }
+                    ast = list->item(argCount);
+                    continue; // TCO
                 }
-                ast = list->item(argCount);
-                continue; // TCO
-            }
 
-            if (special == "fn*") {
-                checkArgsIs("fn*", 2, argCount);
+                case SPECIAL_FN: {
+                    checkArgsIs("fn*", 2, argCount);
 
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                StringVec params;
-                for (int i = 0; i < bindings->count(); i++) {
-                    const malSymbol* sym =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    params.push_back(sym->value());
-                }
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    malValueVec params;
+                    for (int i = 0; i < bindings->count(); i++) {
+                        params.push_back(
+                            VALUE_CAST(malSymbol, bindings->item(i)));
+                    }
 
-                return mal::lambda(params, list->item(2), env);
-            }
+                    return mal::lambda(params, list->item(2), env);
+                }
 
-            if (special == "if") {
-                checkArgsBetween("if", 2, 3, argCount);
+                case SPECIAL_IF: {
+                    checkArgsBetween("if", 2, 3, argCount);
 
-                bool isTrue = EVAL(list->item(1), env)->isTrue();
-                if (!isTrue && (argCount == 2)) {
-                    return mal::nilValue();
+                    bool isTrue = EVAL(list->item(1), env).isTrue();
+                    if (!isTrue && (argCount == 2)) {
+                        return mal::nilValue();
+                    }
+                    ast = list->item(isTrue ? 2 : 3);
+                    continue; // TCO
                 }
-                ast = list->item(isTrue ? 2 : 3);
-                continue; // TCO
-            }
 
-            if (special == "let*") {
-                checkArgsIs("let*", 2, argCount);
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                int count = checkArgsEven("let*", bindings->count());
-                malEnvPtr inner(new malEnv(env));
-                for (int i = 0; i < count; i += 2) {
-                    const malSymbol* var =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                case SPECIAL_LET: {
+                    checkArgsIs("let*", 2, argCount);
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    int count = checkArgsEven("let*", bindings->count());
+                    malEnvPtr inner(malEnv::create(env, count / 2));
+                    for (int i = 0; i < count; i += 2) {
+                        const malSymbol* var =
+                            VALUE_CAST(malSymbol, bindings->item(i));
+                        inner->set(var, EVAL(bindings->item(i+1), inner));
+                    }
+                    ast = list->item(2);
+                    env = inner;
+                    continue; // TCO
                 }
-                ast = list->item(2);
-                env = inner;
-                continue; // TCO
-            }
 
-            if (special == "quasiquote") {
-                checkArgsIs("quasiquote", 1, argCount);
-                ast = quasiquote(list->item(1));
-                continue; // TCO
-            }
+                case SPECIAL_QUASIQUOTE: {
+                    checkArgsIs("quasiquote", 1, argCount);
+                    ast = quasiquote(list->item(1));
+                    continue; // TCO
+                }
 
-            if (special == "quote") {
-                checkArgsIs("quote", 1, argCount);
-                return list->item(1);
+                case SPECIAL_QUOTE: {
+                    checkArgsIs("quote", 1, argCount);
+                    return list->item(1);
+                }
             }
         }
 
         // Now we're left with the case of a regular list to be evaluated.
-        std::unique_ptr<malValueVec> items(list->evalItems(env));
-        malValuePtr op = items->at(0);
+        malArgs items(list->count());
+        list->evalItems(items.begin(), env);
+        const malValuePtr& op = items[0];
         if (const malLambda* lambda = DYNAMIC_CAST(malLambda, op)) {
             ast = lambda->getBody();
-            env = lambda->makeEnv(items->begin()+1, items->end());
+            env = lambda->makeEnv(items.begin()+1, items.end());
             continue; // TCO
         }
         else {
-            return APPLY(op, items->begin()+1, items->end());
+            return APPLY(op, items.begin()+1, items.end());
         }
     }
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -186,19 +204,19 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
     return handler->apply(argsBegin, argsEnd);
 }
 
-static bool isSymbol(malValuePtr obj, const String& text)
+static bool isSymbol(const malValuePtr& obj, const String& text)
 {
     const malSymbol* sym = DYNAMIC_CAST(malSymbol, obj);
     return sym && (sym->value() == text);
 }
 
-static const malSequence* isPair(malValuePtr obj)
+static const malSequence* isPair(const malValuePtr& obj)
 {
     const malSequence* list = DYNAMIC_CAST(malSequence, obj);
     return list && !list->isEmpty() ? list : NULL;
 }
 
-static malValuePtr quasiquote(malValuePtr obj)
+static malValuePtr quasiquote(const malValuePtr& obj)
 {
     const malSequence* seq = isPair(obj);
     if (!seq) {
@@ -242,7 +260,7 @@ static const char* malFunctionTable[] = {
         (eval (read-string (str \"(do \" (slurp filename) \")\")))))",
 };
 
-static void installFunctions(malEnvPtr env) {
+static void installFunctions(const malEnvPtr& env) {
     for (auto &function : malFunctionTable) {
         rep(function, env);
     }
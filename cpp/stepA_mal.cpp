@@ -1,30 +1,44 @@
 #include "MAL.h"
 
+#include "ArgStack.h"
 #include "Environment.h"
 #include "ReadLine.h"
 #include "Types.h"
 
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <utility>
 
 malValuePtr READ(const String& input);
-String PRINT(malValuePtr ast);
-static void installFunctions(malEnvPtr env);
+String PRINT(const malValuePtr& ast);
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env);
+static void installFunctions(const malEnvPtr& env);
 
-static void makeArgv(malEnvPtr env, int argc, char* argv[]);
-static String safeRep(const String& input, malEnvPtr env);
-static malValuePtr quasiquote(malValuePtr obj);
-static malValuePtr macroExpand(malValuePtr obj, malEnvPtr env);
-static void installMacros(malEnvPtr env);
+static void makeArgv(const malEnvPtr& env, int argc, char* argv[]);
+static String safeRep(const String& input, const malEnvPtr& env);
+static malValuePtr quasiquote(const malValuePtr& obj);
+static malValuePtr macroExpand(malValuePtr obj, const malEnvPtr& env);
+static void installMacros(const malEnvPtr& env);
 
 static ReadLine s_readLine("~/.mal-history");
 
 static malEnvPtr replEnv(new malEnv);
 
+static void reportMemStats()
+{
+    memStats::report(stderr);
+}
+
 int main(int argc, char* argv[])
 {
     String prompt = "user> ";
     String input;
+    if ((argc > 1) && (strcmp(argv[1], "--mem-stats") == 0)) {
+        atexit(reportMemStats);
+        argc--;
+        argv++;
+    }
     installCore(replEnv);
     installFunctions(replEnv);
     installMacros(replEnv);
@@ -43,7 +57,7 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-static String safeRep(const String& input, malEnvPtr env)
+static String safeRep(const String& input, const malEnvPtr& env)
 {
     try {
         return rep(input, env);
@@ -56,7 +70,7 @@ static String safeRep(const String& input, malEnvPtr env)
     };
 }
 
-static void makeArgv(malEnvPtr env, int argc, char* argv[])
+static void makeArgv(const malEnvPtr& env, int argc, char* argv[])
 {
     malValueVec* args = new malValueVec();
     for (int i = 0; i < argc; i++) {
@@ -65,7 +79,7 @@ static void makeArgv(malEnvPtr env, int argc, char* argv[])
     env->set("*ARGV*", mal::list(args));
 }
 
-String rep(const String& input, malEnvPtr env)
+String rep(const String& input, const malEnvPtr& env)
 {
     return PRINT(EVAL(READ(input), env));
 }
@@ -75,18 +89,32 @@ malValuePtr READ(const String& input)
     return readStr(input);
 }
 
-malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
+malValuePtr EVAL(const malValuePtr& ast, const malEnvPtr& env)
 {
     if (!env) {
-        env = replEnv;
+        return EVAL(ast, replEnv);
+    }
+    const malList* list = DYNAMIC_CAST(malList, ast);
+    if (!list || (list->count() == 0)) {
+        COUNT_REF(evals);
+        return ast->eval(env);
     }
+
+    // Only lists go round the TCO loop, which needs references of its own
+    // to ast and env. Anything else is evaluated without copying them.
+    return evalList(ast, env);
+}
+
+static malValuePtr evalList(malValuePtr ast, malEnvPtr env)
+{
     while (1) {
+        COUNT_REF(evals);
         const malList* list = DYNAMIC_CAST(malList, ast);
         if (!list || (list->count() == 0)) {
             return ast->eval(env);
         }
 
-        ast = macroExpand(ast, env);
+        ast = macroExpand(std::move(ast), env);
         list = DYNAMIC_CAST(malList, ast);
         if (!list || (list->count() == 0)) {
             return ast->eval(env);
@@ -95,154 +123,157 @@ malValuePtr EVAL(malValuePtr ast, malEnvPtr env)
         // From here on down we are evaluating a non-empty list.
         // First handle the special forms.
         if (const malSymbol* symbol = DYNAMIC_CAST(malSymbol, list->item(0))) {
-            String special = symbol->value();
             int argCount = list->count() - 1;
 
-            if (special == "def!") {
-                checkArgsIs("def!", 2, argCount);
-                const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                return env->set(id->value(), EVAL(list->item(2), env));
-            }
-
-            if (special == "defmacro!") {
-                checkArgsIs("defmacro!", 2, argCount);
-
-                const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
-                malValuePtr body = EVAL(list->item(2), env);
-                const malLambda* lambda = VALUE_CAST(malLambda, body);
-                return env->set(id->value(), mal::macro(*lambda));
-            }
-
-            if (special == "do") {
-                checkArgsAtLeast("do", 1, argCount);
-
-                for (int i = 1; i < argCount; i++) {
-                    EVAL(list->item(i), env);
+            switch (symbol->id()) {
+                case SPECIAL_DEF: {
+                    checkArgsIs("def!", 2, argCount);
+                    const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
+                    return env->set(id, EVAL(list->item(2), env));
                 }
-                ast = list->item(argCount);
-                continue; // TCO
-            }
 
-            if (special == "fn*") {
-                checkArgsIs("fn*", 2, argCount);
+                case SPECIAL_DEFMACRO: {
+                    checkArgsIs("defmacro!", 2, argCount);
 
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                StringVec params;
-                for (int i = 0; i < bindings->count(); i++) {
-                    const malSymbol* sym =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    params.push_back(sym->value());
+                    const malSymbol* id = VALUE_CAST(malSymbol, list->item(1));
+                    malValuePtr body = EVAL(list->item(2), env);
+                    const malLambda* lambda = VALUE_CAST(malLambda, body);
+                    return env->set(id, mal::macro(*lambda));
                 }
 
-                return mal::lambda(params, list->item(2), env);
-            }
+                case SPECIAL_DO: {
+                    checkArgsAtLeast("do", 1, argCount);
 
-            if (special == "if") {
-                checkArgsBetween("if", 2, 3, argCount);
-
-                bool isTrue = EVAL(list->item(1), env)->isTrue();
-                if (!isTrue && (argCount == 2)) {
-                    return mal::nilValue();
-                }
-                ast = list->item(isTrue ? 2 : 3);
-                continue; // TCO
-            }
-
-            if (special == "let*") {
-                checkArgsIs("let*", 2, argCount);
-                const malSequence* bindings =
-                    VALUE_CAST(malSequence, list->item(1));
-                int count = checkArgsEven("let*", bindings->count());
-                malEnvPtr inner(new malEnv(env));
-                for (int i = 0; i < count; i += 2) {
-                    const malSymbol* var =
-                        VALUE_CAST(malSymbol, bindings->item(i));
-                    inner->set(var->value(), EVAL(bindings->item(i+1), inner));
+                    for (int i = 1; i < argCount; i++) {
+                        EVAL(list->item(i), env);
+                    }
+                    ast = list->item(argCount);
+                    continue; // TCO
                 }
-                ast = list->item(2);
-                env = inner;
-                continue; // TCO
-            }
-
-            if (special == "macroexpand") {
-                checkArgsIs("macroexpand", 1, argCount);
-                return macroExpand(list->item(1), env);
-            }
 
-            if (special == "quasiquote") {
-                checkArgsIs("quasiquote", 1, argCount);
-                ast = quasiquote(list->item(1));
-                continue; // TCO
-            }
+                case SPECIAL_FN: {
+                    checkArgsIs("fn*", 2, argCount);
 
-            if (special == "quote") {
-                checkArgsIs("quote", 1, argCount);
-                return list->item(1);
-            }
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    malValueVec params;
+                    for (int i = 0; i < bindings->count(); i++) {
+                        params.push_back(
+                            VALUE_CAST(malSymbol, bindings->item(i)));
+                    }
 
-            if (special == "try*") {
-                checkArgsIs("try*", 2, argCount);
-                malValuePtr tryBody = list->item(1);
-                const malList* catchBlock = VALUE_CAST(malList, list->item(2));
+                    return mal::lambda(params, list->item(2), env);
+                }
 
-                checkArgsIs("catch*", 2, catchBlock->count() - 1);
-                MAL_CHECK(VALUE_CAST(malSymbol,
-                    catchBlock->item(0))->value() == "catch*",
-                    "catch block must begin with catch*");
+                case SPECIAL_IF: {
+                    checkArgsBetween("if", 2, 3, argCount);
 
-                // We don't need excSym at this scope, but we want to check
-                // that the catch block is valid always, not just in case of
-                // an exception.
-                const malSymbol* excSym =
-                    VALUE_CAST(malSymbol, catchBlock->item(1));
+                    bool isTrue = EVAL(list->item(1), env).isTrue();
+                    if (!isTrue && (argCount == 2)) {
+                        return mal::nilValue();
+                    }
+                    ast = list->item(isTrue ? 2 : 3);
+                    continue; // TCO
+                }
 
-                malValuePtr excVal;
+                case SPECIAL_LET: {
+                    checkArgsIs("let*", 2, argCount);
+                    const malSequence* bindings =
+                        VALUE_CAST(malSequence, list->item(1));
+                    int count = checkArgsEven("let*", bindings->count());
+                    malEnvPtr inner(malEnv::create(env, count / 2));
+                    for (int i = 0; i < count; i += 2) {
+                        const malSymbol* var =
+                            VALUE_CAST(malSymbol, bindings->item(i));
+                        inner->set(var, EVAL(bindings->item(i+1), inner));
+                    }
+                    ast = list->item(2);
+                    env = inner;
+                    continue; // TCO
+                }
 
-                try {
-                    ast = EVAL(tryBody, env);
+                case SPECIAL_MACROEXPAND: {
+                    checkArgsIs("macroexpand", 1, argCount);
+                    return macroExpand(list->item(1), env);
                 }
-                catch(String& s) {
-                    excVal = mal::string(s);
+
+                case SPECIAL_QUASIQUOTE: {
+                    checkArgsIs("quasiquote", 1, argCount);
+                    ast = quasiquote(list->item(1));
+                    continue; // TCO
                 }
-                catch (malEmptyInputException&) {
-                    // Not an error, continue as if we got nil
-                    ast = mal::nilValue();
+
+                case SPECIAL_QUOTE: {
+                    checkArgsIs("quote", 1, argCount);
+                    return list->item(1);
                 }
-                catch(malValuePtr& o) {
-                    excVal = o;
-                };
-
-                if (excVal) {
-                    // we got some exception
-                    env = malEnvPtr(new malEnv(env));
-                    env->set(excSym->value(), excVal);
-                    ast = catchBlock->item(2);
+
+                case SPECIAL_TRY: {
+                    checkArgsIs("try*", 2, argCount);
+                    malValuePtr tryBody = list->item(1);
+                    const malList* catchBlock =
+                        VALUE_CAST(malList, list->item(2));
+
+                    checkArgsIs("catch*", 2, catchBlock->count() - 1);
+                    MAL_CHECK(VALUE_CAST(malSymbol,
+                        catchBlock->item(0))->id() == SPECIAL_CATCH,
+                        "catch block must begin with catch*");
+
+                    // We don't need excSym at this scope, but we want to check
+                    // that the catch block is valid always, not just in case of
+                    // an exception.
+                    const malSymbol* excSym =
+                        VALUE_CAST(malSymbol, catchBlock->item(1));
+
+                    malValuePtr excVal;
+
+                    try {
+                        ast = EVAL(tryBody, env);
+                    }
+                    catch(String& s) {
+                        excVal = mal::string(s);
+                    }
+                    catch (malEmptyInputException&) {
+                        // Not an error, continue as if we got nil
+                        ast = mal::nilValue();
+                    }
+                    catch(malValuePtr& o) {
+                        excVal = o;
+                    };
+
+                    if (excVal) {
+                        // we got some exception
+                        env = malEnvPtr(malEnv::create(env, 1));
+                        env->set(excSym, excVal);
+                        ast = catchBlock->item(2);
+                    }
+                    continue; // TCO
                 }
-                continue; // TCO
             }
         }
 
         // Now we're left with the case of a regular list to be evaluated.
-        std::unique_ptr<malValueVec> items(list->evalItems(env));
-        malValuePtr op = items->at(0);
+        malArgs items(list->count());
+        list->evalItems(items.begin(), env);
+        const malValuePtr& op = items[0];
         if (const malLambda* lambda = DYNAMIC_CAST(malLambda, op)) {
             ast = lambda->getBody();
-            env = lambda->makeEnv(items->begin()+1, items->end());
+            env = lambda->makeEnv(items.begin()+1, items.end());
             continue; // TCO
         }
         else {
-            return APPLY(op, items->begin()+1, items->end());
+            return APPLY(op, items.begin()+1, items.end());
         }
     }
 }
 
-String PRINT(malValuePtr ast)
+String PRINT(const malValuePtr& ast)
 {
     return ast->print(true);
 }
 
-malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
+malValuePtr APPLY(const malValuePtr& op,
+                  malValueIter argsBegin, malValueIter argsEnd)
 {
     const malApplicable* handler = DYNAMIC_CAST(malApplicable, op);
     MAL_CHECK(handler != NULL,
@@ -251,19 +282,19 @@ malValuePtr APPLY(malValuePtr op, malValueIter argsBegin, malValueIter argsEnd)
     return handler->apply(argsBegin, argsEnd);
 }
 
-static bool isSymbol(malValuePtr obj, const String& text)
+static bool isSymbol(const malValuePtr& obj, const String& text)
 {
     const malSymbol* sym = DYNAMIC_CAST(malSymbol, obj);
     return sym && (sym->value() == text);
 }
 
-static const malSequence* isPair(malValuePtr obj)
+static const malSequence* isPair(const malValuePtr& obj)
 {
     const malSequence* list = DYNAMIC_CAST(malSequence, obj);
     return list && !list->isEmpty() ? list : NULL;
 }
 
-static malValuePtr quasiquote(malValuePtr obj)
+static malValuePtr quasiquote(const malValuePtr& obj)
 {
     const malSequence* seq = isPair(obj);
     if (!seq) {
@@ -297,13 +328,14 @@ static malValuePtr quasiquote(malValuePtr obj)
     }
 }
 
-static const malLambda* isMacroApplication(malValuePtr obj, malEnvPtr env)
+static const malLambda* isMacroApplication(const malValuePtr& obj,
+                                           const malEnvPtr& env)
 {
     if (const malSequence* seq = isPair(obj)) {
-        if (malSymbol* sym = DYNAMIC_CAST(malSymbol, seq->first())) {
-            if (malEnvPtr symEnv = env->find(sym->value())) {
-                malValuePtr value = sym->eval(symEnv);
-                if (malLambda* lambda = DYNAMIC_CAST(malLambda, value)) {
+        malSymbol* sym = DYNAMIC_CAST(malSymbol, seq->item(0));
+        if (sym && malEnv::mayNameMacro(sym->id())) {
+            if (const malValuePtr* value = env->lookup(sym)) {
+                if (malLambda* lambda = DYNAMIC_CAST(malLambda, *value)) {
                     return lambda->isMacro() ? lambda : NULL;
                 }
             }
@@ -312,11 +344,23 @@ static const malLambda* isMacroApplication(malValuePtr obj, malEnvPtr env)
     return NULL;
 }
 
-static malValuePtr macroExpand(malValuePtr obj, malEnvPtr env)
+static malValuePtr macroExpand(malValuePtr obj, const malEnvPtr& env)
 {
     while (const malLambda* macro = isMacroApplication(obj, env)) {
-        const malSequence* seq = STATIC_CAST(malSequence, obj);
-        obj = macro->apply(seq->begin() + 1, seq->end());
+        // A form expands the same way each time, for as long as its head
+        // names the same macro.
+        unsigned macroId = macro->macroId();
+        malValuePtr expansion = obj->cachedExpansion(macroId);
+        if (!expansion) {
+            // The macro may rebind its own name while it runs, which would
+            // free it if the environment held the only reference.
+            malValuePtr hold(const_cast<malLambda*>(macro));
+            const malSequence* seq = STATIC_CAST(malSequence, obj);
+            malValueVec args(seq->begin(), seq->end());
+            expansion = macro->apply(args.begin() + 1, args.end());
+            obj->cacheExpansion(macroId, expansion);
+        }
+        obj = std::move(expansion);
     }
     return obj;
 }
@@ -326,7 +370,7 @@ static const char* macroTable[] = {
     "(defmacro! or (fn* (& xs) (if (empty? xs) nil (if (= 1 (count xs)) (first xs) (let* (condvar (gensym)) `(let* (~condvar ~(first xs)) (if ~condvar ~condvar (or ~@(rest xs)))))))))",
 };
 
-static void installMacros(malEnvPtr env)
+static void installMacros(const malEnvPtr& env)
 {
     for (auto &macro : macroTable) {
         rep(macro, env);
@@ -357,7 +401,7 @@ static const char* malFunctionTable[] = {
     "(def! *host-language* \"C++\")",
 };
 
-static void installFunctions(malEnvPtr env) {
+static void installFunctions(const malEnvPtr& env) {
     for (auto &function : malFunctionTable) {
         rep(function, env);
     }